@@ -31,6 +31,28 @@
 #define MFACT 0.5
 /* scroll back buffer size in lines */
 #define SCROLL_HISTORY 500
+/* bytes of terminal output processed per client and main loop iteration,
+ * it is scaled down according to the nice level [0 .. 19] of the client.
+ * At the default level 0 this is what a single read processed before, the
+ * nice command of the command FIFO is what throttles a client */
+#define PROCESS_BUDGET 8192
+/* bytes of terminal output buffered per client by the reader thread,
+ * a power of two (only used if built with CONFIG_READER_THREAD) */
+#define READ_BUFFER_SIZE (64 * 1024)
+/* threads parsing the buffered output in parallel to the main thread,
+ * -1 starts one per additional CPU (also CONFIG_READER_THREAD only) */
+#define PARSE_THREADS -1
+/* milliseconds the size of the host terminal has to remain unchanged
+ * before the layout and the applications are adapted to it */
+#define RESIZE_DELAY 50
+/* shells started ahead of time so new windows are ready immediately,
+ * they are handed out by create commands without arguments */
+#define SHELL_POOL 0
+/* milliseconds after the last command a batch started by the begin
+ * command of the command FIFO is committed even if commit never comes */
+#define BATCH_TIMEOUT 1000
+/* milliseconds a notice, e.g. about a truncated paste, replaces the status text */
+#define NOTICE_TIMEOUT 3000
 
 #include "tile.c"
 #include "grid.c"
@@ -144,6 +166,8 @@ static Button buttons[] = {
 #endif /* CONFIG_MOUSE */
 
 static Cmd commands[] = {
+	{ "begin",          { batchbegin,     { NULL }                    } },
+	{ "commit",         { batchcommit,    { NULL }                    } },
 	{ "create",         { create,	      { NULL }                    } },
 	{ "createcwd",      { create,         { NULL, NULL, "$CWD" }      } },
 	{ "killclient",     { killclient,     { NULL }                    } },
@@ -160,6 +184,7 @@ static Cmd commands[] = {
 	{ "focus",          { focusn,         { NULL }                    } },
 	{ "focusid",        { focusid,        { NULL }                    } },
 	{ "titleid",        { titleid,        { NULL }                    } },
+	{ "nice",           { niceid,         { NULL }                    } },
 	{ "quit",           { quit,           { NULL }                    } },
 	{ "escapekey",      { escapekey,      { NULL }                    } },
 	{ "togglerunall",   { togglerunall,   { NULL }                    } },
@@ -170,6 +195,7 @@ static Cmd commands[] = {
 	{ "paste",          { paste,          { NULL }                    } },
 	{ "scrollback",     { scrollback,     { NULL }                    } },
 	{ "inputmode",      { setinputmode,   { NULL }                    } },
+	{ "subscribe",      { subscribe,      { NULL }                    } },
 	{ "help",           { create,         { "man dvtm", "dvtm help" } } },
 };
 
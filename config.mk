@@ -15,6 +15,10 @@ LIBS = -lc -lutil -lncursesw
 # Cygwin
 #INCS += -I/usr/include/ncurses
 
+# Linux: read the ptys from a dedicated thread while the main loop is busy
+#CFLAGS += -DCONFIG_READER_THREAD
+#LIBS += -pthread
+
 CFLAGS += -std=c99 -Os ${INCS} -DVERSION=\"${VERSION}\" -DNDEBUG
 LDFLAGS += -L/usr/lib -L/usr/local/lib ${LIBS}
 
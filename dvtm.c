@@ -17,21 +17,46 @@
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <curses.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <signal.h>
 #include <locale.h>
+#include <poll.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <ctype.h>
 #ifdef __CYGWIN__
 # include <termios.h>
 #endif
+#ifdef __linux__
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+# include <sys/syscall.h>
+# define HAVE_EPOLL
+# define HAVE_SIGNALFD
+#endif
+#if defined(CONFIG_READER_THREAD) && !defined(HAVE_EPOLL)
+# undef CONFIG_READER_THREAD
+#endif
+#ifdef CONFIG_READER_THREAD
+# include <pthread.h>
+# include <stdint.h>
+# include <sys/eventfd.h>
+#endif
 #include "vt.h"
 
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
 #ifdef PDCURSES
 int ESCDELAY;
 #endif
@@ -46,6 +71,7 @@ typedef struct {
 	int w;
 	int h;
 	bool need_resize;
+	struct timespec resized; /* last size change of the host terminal */
 } Screen;
 
 typedef struct {
@@ -53,15 +79,41 @@ typedef struct {
 	void (*arrange)(void);
 } Layout;
 
+/* what was last rendered into the first line of a client */
+typedef struct {
+	char text[320];
+	attr_t attrs;
+	int width;
+	int end; /* column following the title */
+} Border;
+
+#ifdef CONFIG_READER_THREAD
+/* pty output read by the reader thread (single producer) and parsed by
+ * the main thread (single consumer), head and tail are free running */
+typedef struct {
+	char *buf;
+	size_t size; /* power of two */
+	size_t head; /* only advanced by the reader thread */
+	size_t tail; /* only advanced by the main thread */
+	int stalled; /* the reader stopped watching the full ring's pty */
+	int error;   /* errno of the final read, the pty was closed */
+} Ring;
+#endif
+
 typedef struct Client Client;
 struct Client {
-	WINDOW *window;
 	Vt *term;
-	const char *cmd;
+	char *cmd;
 	char title[255];
+	Border border;
 	int order;
+	int nice; /* 0 .. 19, scales the PROCESS_BUDGET */
 	pid_t pid;
+	int pidfd; /* readable once the process terminated, -1 if unsupported */
 	int pty;
+#ifdef CONFIG_READER_THREAD
+	Ring ring;
+#endif
 	unsigned short int id;
 	unsigned short int x;
 	unsigned short int y;
@@ -69,6 +121,10 @@ struct Client {
 	unsigned short int h;
 	bool minimized;
 	bool died;
+	bool dirty; /* needs to be drawn by the next render() */
+	bool held;  /* pty not read until copy mode ends, its output is held back */
+	bool pooled; /* started ahead of time, not yet handed out by create() */
+	bool unplaced; /* created in an open batch, has no area of the layout yet */
 	Client *next;
 	Client *prev;
 };
@@ -90,6 +146,12 @@ typedef struct {
 #define CTRL_ALT(k) ((k) + (129 - 'a'))
 
 #define MAX_ARGS 3
+/* longest line accepted through the command FIFO */
+#define CMD_LINE_MAX 4096
+/* bytes of records queued for a slow reader of the event FIFO */
+#define EVENT_QUEUE_SIZE (64 * 1024)
+/* simultaneous connections to the control socket */
+#define CONTROL_MAX 32
 
 typedef struct {
 	void (*cmd)(const char *args[]);
@@ -124,6 +186,8 @@ typedef struct {
 	unsigned short int h;
 	unsigned short int y;
 	char text[512];
+	char notice[128];           /* shown instead of text until it expires */
+	struct timespec noticed;
 	const char *file;
 } StatusBar;
 
@@ -131,11 +195,62 @@ typedef struct {
 	int fd;
 	const char *file;
 	unsigned short int id;
+	char buf[CMD_LINE_MAX]; /* the incomplete line received so far */
+	size_t len;
+	bool overlong;          /* the current line did not fit and is dropped */
 } CmdFifo;
 
+/* file descriptors monitored by the main loop, clients register theirs
+ * together with a pointer to themselves which is looked up by descriptor */
+typedef struct {
+#ifdef HAVE_EPOLL
+	int fd;
+	struct epoll_event *events;
+#else
+	struct pollfd *fds;
+#endif
+	void **data;  /* indexed by file descriptor */
+	short *mask;  /* POLLIN and POLLOUT, indexed by file descriptor */
+	int ndata;
+	int *ready;   /* readable descriptors, -1 once unwatched */
+	int nready;
+	int *writable; /* writable descriptors, -1 once unwatched */
+	int nwritable;
+	int count;
+	int size;
+} Watcher;
+
+/* the input from the host terminal is decoded by dvtm itself, sequences
+ * of known keys are looked up in a trie built from terminfo */
+typedef struct KeyNode KeyNode;
+struct KeyNode {
+	KeyNode *child;       /* continuations of the sequence */
+	KeyNode *next;        /* alternatives for the same position */
+	unsigned char byte;
+	int code;             /* curses key code if a key ends here, otherwise 0 */
+};
+
+#define INPUT_SEQ_MAX 64
+
+typedef struct {
+	unsigned char buf[BUFSIZ];
+	size_t start, len;    /* undecoded bytes */
+	KeyNode *keys;
+	bool incomplete;      /* buf starts with the prefix of a sequence */
+	struct timespec since;
+	MEVENT mouse;         /* the most recently decoded mouse event */
+	mmask_t clicks;       /* its meaning for the key bindings, 0 if none */
+	mmask_t mask;
+	int button;           /* currently pressed button */
+	bool twice;           /* the press followed a click of the same button */
+	int clicked;          /* button of the last click */
+	struct timespec pressed, released;
+} Input;
+
 #define countof(arr) (sizeof(arr) / sizeof((arr)[0]))
 #define sstrlen(str) (sizeof(str) - 1)
 #define max(x, y) ((x) > (y) ? (x) : (y))
+#define min(x, y) ((x) < (y) ? (x) : (y))
 
 #ifdef NDEBUG
  #define debug(format, args...)
@@ -144,6 +259,8 @@ typedef struct {
 #endif
 
 /* commands for use by keybindings */
+static void batchbegin(const char *args[]);
+static void batchcommit(const char *args[]);
 static void create(const char *args[]);
 static void copymode(const char *args[]);
 static void escapekey(const char *args[]);
@@ -169,7 +286,9 @@ static void togglerunall(const char *args[]);
 static void zoom(const char *args[]);
 static void focusid(const char *args[]);
 static void titleid(const char *args[]);
+static void niceid(const char *args[]);
 static void setinputmode(const char *args[]);
+static void subscribe(const char *args[]);
 
 /* commands for use by mouse bindings */
 static void mouse_focus(const char *args[]);
@@ -191,15 +310,101 @@ static char *title;
 Screen screen = { MFACT, SCROLL_HISTORY };
 static Client *sel = NULL;
 static Client *msel = NULL;
+/* receives all mouse events while a button is held */
+static Client *mgrab = NULL;
+/* the latest motion not yet passed on to the application of mgrab */
+static MEVENT mmotion;
+static bool mmotion_pending;
 static bool mouse_events_enabled = ENABLE_MOUSE;
 static Layout *layout = layouts;
 static StatusBar bar = { -1, BAR_POS, 1 };
 static CmdFifo cmdfifo = { -1 };
 static CmdFifo evtfifo = { -1 };
+static struct {
+	Cmd **slots;
+	unsigned int mask;
+} cmds;
+/* a reader of event records: the event FIFO or a control connection,
+ * the records are queued and written once per main loop round */
+typedef struct Subscriber Subscriber;
+struct Subscriber {
+	int fd;
+	bool packets;           /* one message per record instead of a stream */
+	unsigned int mask;      /* subscribed types, bit n is 'A' + n */
+	char buf[EVENT_QUEUE_SIZE]; /* ring buffer */
+	size_t start, len;
+	size_t mark;            /* length before the record being added */
+	bool active;            /* the record being added is meant for it */
+	bool truncated;         /* the record being added does not fit */
+	unsigned int dropped;   /* records lost since the queue was full */
+	int batches;            /* begin commands it has not yet committed */
+	Subscriber *next;
+};
+static Subscriber fifosub = { .fd = -1, .mask = ~0u };
+static Subscriber *subscribers; /* fifosub if there is an event FIFO and the connections */
+static Subscriber *requester;   /* whose command is being executed */
+static struct {
+	int fd;
+	const char *file;
+	int count;              /* connections */
+} control = { -1 };
+static Watcher watcher;
+static Input input;
 static const char *shell;
+/* shells started ahead of time, create() hands them out instead of
+ * waiting for a new one to initialize */
+static struct {
+	Client *clients; /* linked through next */
+	int spawn;       /* shells still to be started */
+} pool = { NULL, SHELL_POOL };
+/* the layout is only arranged and redrawn once the outermost batch of
+ * commands is committed */
+static struct {
+	int depth;
+	bool arrange;          /* an arrange() was held back */
+	struct timespec since; /* last command of the open batch */
+} batch;
 static char *copybuf;
 static volatile sig_atomic_t running = true;
+static volatile sig_atomic_t children_died = false;
+#ifdef HAVE_SIGNALFD
+/* delivers SIGWINCH, SIGCHLD and SIGTERM as ordinary events */
+static int sigfd = -1;
+#endif
+#ifdef CONFIG_READER_THREAD
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock; /* protects clients against concurrent removal */
+	Client **clients;     /* indexed by pty */
+	int nclients;
+	int epfd;             /* ptys whose ring is not full */
+	int evfd;             /* signals new data to the main loop */
+} reader;
+
+/* parse the rings of all clients in parallel, each thread (including the
+ * main one) repeatedly grabs the next job until none are left */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+	pthread_cond_t finished;
+	unsigned round;       /* incremented for every batch of jobs */
+	int busy;             /* workers still running the current round */
+	int threads;
+	Client **jobs;
+	int *results;         /* of ring_consume */
+	int count;
+	int size;
+	int next;             /* index of the next unclaimed job */
+} workers;
+#endif
 static bool runinall = false;
+static int cursor_visible = -1;
+/* all visible clients need to be drawn by the next render() */
+static bool redraw_all = true;
+/* a dry run of the layout only moves the clients which are not yet placed */
+static bool placing;
+/* begin and end of a synchronized update (DEC mode 2026) on the host terminal */
+static char *sync_begin, *sync_end;
 static int inputmode = PIPE_NONE;
 
 static void
@@ -224,23 +429,481 @@ isarrange(void (*func)()) {
 	return func == layout->arrange;
 }
 
+static void
+watcher_init() {
+#ifdef HAVE_EPOLL
+	if ((watcher.fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		error("epoll_create1: %s\n", strerror(errno));
+#endif
+}
+
+/* changes the events fd is monitored for, 0 removes it altogether */
+static void
+watcher_update(int fd, short mask) {
+	short old = watcher.mask[fd];
+
+	if (mask == old)
+		return;
+	if (!old && watcher.count == watcher.size) {
+		int size = watcher.size ? 2 * watcher.size : 16;
+		int *ready = realloc(watcher.ready, size * sizeof(*ready));
+		int *writable = realloc(watcher.writable, size * sizeof(*writable));
+		if (ready)
+			watcher.ready = ready;
+		if (writable)
+			watcher.writable = writable;
+		if (!ready || !writable)
+			error("out of memory\n");
+#ifdef HAVE_EPOLL
+		struct epoll_event *events = realloc(watcher.events, size * sizeof(*events));
+		if (!events)
+			error("out of memory\n");
+		watcher.events = events;
+#else
+		struct pollfd *fds = realloc(watcher.fds, size * sizeof(*fds));
+		if (!fds)
+			error("out of memory\n");
+		watcher.fds = fds;
+#endif
+		watcher.size = size;
+	}
+#ifdef HAVE_EPOLL
+	struct epoll_event ev = { .data.fd = fd };
+	if (mask & POLLIN)
+		ev.events |= EPOLLIN;
+	if (mask & POLLOUT)
+		ev.events |= EPOLLOUT;
+	if (epoll_ctl(watcher.fd, !old ? EPOLL_CTL_ADD : !mask ? EPOLL_CTL_DEL : EPOLL_CTL_MOD, fd, &ev) == -1)
+		error("epoll_ctl: %s\n", strerror(errno));
+#else
+	if (!old)
+		watcher.fds[watcher.count] = (struct pollfd){ .fd = fd };
+	for (int i = 0; i < watcher.count + !old; i++) {
+		if (watcher.fds[i].fd != fd)
+			continue;
+		if (mask)
+			watcher.fds[i].events = mask;
+		else
+			watcher.fds[i] = watcher.fds[watcher.count - 1];
+		break;
+	}
+#endif
+	if (!old)
+		watcher.count++;
+	else if (!mask)
+		watcher.count--;
+	watcher.mask[fd] = mask;
+}
+
+static void
+watch(int fd, void *data) {
+	if (fd >= watcher.ndata) {
+		int ndata = max(fd + 1, 2 * watcher.ndata);
+		void **data = realloc(watcher.data, ndata * sizeof(*data));
+		short *mask = realloc(watcher.mask, ndata * sizeof(*mask));
+		if (data)
+			watcher.data = data;
+		if (mask)
+			watcher.mask = mask;
+		if (!data || !mask)
+			error("out of memory\n");
+		memset(data + watcher.ndata, 0, (ndata - watcher.ndata) * sizeof(*data));
+		memset(mask + watcher.ndata, 0, (ndata - watcher.ndata) * sizeof(*mask));
+		watcher.ndata = ndata;
+	}
+	watcher_update(fd, watcher.mask[fd] | POLLIN);
+	watcher.data[fd] = data;
+}
+
+/* starts or stops waiting for fd to become writable, for descriptors which
+ * are not otherwise watched data is registered as by watch */
+static void
+watch_output(int fd, void *data, bool enable) {
+	if (fd < 0)
+		return;
+	if (!enable) {
+		if (fd < watcher.ndata && watcher.mask[fd] & POLLOUT) {
+			watcher_update(fd, watcher.mask[fd] & ~POLLOUT);
+			if (!watcher.mask[fd])
+				watcher.data[fd] = NULL;
+		}
+		return;
+	}
+	if (fd >= watcher.ndata || !watcher.mask[fd]) {
+		watch(fd, data);
+		watcher_update(fd, POLLOUT);
+	} else {
+		watcher_update(fd, watcher.mask[fd] | POLLOUT);
+	}
+}
+
+static void
+unwatch(int fd) {
+	if (fd < 0 || fd >= watcher.ndata)
+		return;
+	watcher_update(fd, 0);
+	watcher.data[fd] = NULL;
+	/* the descriptor number might be reused before the pending events are handled */
+	for (int i = 0; i < watcher.nready; i++) {
+		if (watcher.ready[i] == fd)
+			watcher.ready[i] = -1;
+	}
+	for (int i = 0; i < watcher.nwritable; i++) {
+		if (watcher.writable[i] == fd)
+			watcher.writable[i] = -1;
+	}
+}
+
+/* waits at most timeout milliseconds (-1 for ever) for any of the watched
+ * file descriptors to become ready and stores them in watcher.ready and
+ * watcher.writable. Only these need to be looked at by the caller,
+ * independent of how many descriptors are monitored (except for the
+ * poll(2) fallback which scans all of them once) */
+static int
+watcher_wait(int timeout) {
+	int n;
+	watcher.nready = watcher.nwritable = 0;
+#ifdef HAVE_EPOLL
+	if ((n = epoll_wait(watcher.fd, watcher.events, watcher.size, timeout)) <= 0)
+		return n;
+	for (int i = 0; i < n; i++) {
+		int fd = watcher.events[i].data.fd;
+		uint32_t events = watcher.events[i].events;
+		if (events & EPOLLOUT)
+			watcher.writable[watcher.nwritable++] = fd;
+		if (events & ~EPOLLOUT && (watcher.mask[fd] & POLLIN))
+			watcher.ready[watcher.nready++] = fd;
+	}
+#else
+	if ((n = poll(watcher.fds, watcher.count, timeout)) <= 0)
+		return n;
+	for (int i = 0; i < watcher.count; i++) {
+		int fd = watcher.fds[i].fd;
+		short revents = watcher.fds[i].revents;
+		if (revents & POLLOUT)
+			watcher.writable[watcher.nwritable++] = fd;
+		if (revents & ~POLLOUT && (watcher.mask[fd] & POLLIN))
+			watcher.ready[watcher.nready++] = fd;
+	}
+#endif
+	return watcher.nready + watcher.nwritable;
+}
+
+#ifdef CONFIG_READER_THREAD
+static void
+reader_watch(int fd) {
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+	epoll_ctl(reader.epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* reads from the pty into the ring, returns whether the main loop needs to look at it */
+static bool
+ring_fill(Ring *r, int fd) {
+	size_t head = r->head, tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+	size_t len = r->size - (head - tail), off = head & (r->size - 1);
+
+	if (len == 0) {
+		/* the main thread resumes watching the pty once it made room */
+		epoll_ctl(reader.epfd, EPOLL_CTL_DEL, fd, NULL);
+		__atomic_store_n(&r->stalled, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) != tail &&
+		    __atomic_exchange_n(&r->stalled, 0, __ATOMIC_SEQ_CST))
+			reader_watch(fd);
+		return false;
+	}
+
+	if (len > r->size - off)
+		len = r->size - off;
+	ssize_t n = read(fd, r->buf + off, len);
+	if (n > 0) {
+		__atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+		return true;
+	}
+	if (n == -1 && (errno == EINTR || errno == EAGAIN))
+		return false;
+	epoll_ctl(reader.epfd, EPOLL_CTL_DEL, fd, NULL);
+	__atomic_store_n(&r->error, n == 0 ? EIO : errno, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void *
+reader_thread(void *arg) {
+	struct epoll_event events[64];
+	for (;;) {
+		int n = epoll_wait(reader.epfd, events, countof(events), -1);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return NULL;
+		}
+		bool notify = false;
+		pthread_mutex_lock(&reader.lock);
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			Client *c = fd < reader.nclients ? reader.clients[fd] : NULL;
+			if (c && ring_fill(&c->ring, fd))
+				notify = true;
+		}
+		pthread_mutex_unlock(&reader.lock);
+		if (notify) {
+			uint64_t one = 1;
+			write(reader.evfd, &one, sizeof one);
+		}
+	}
+}
+
+static void
+reader_init() {
+	if ((reader.epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+	    (reader.evfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1)
+		error("reader: %s\n", strerror(errno));
+	pthread_mutex_init(&reader.lock, NULL);
+	/* the thread inherits the blocked signals from the main thread */
+	if ((errno = pthread_create(&reader.thread, NULL, reader_thread, NULL)))
+		error("pthread_create: %s\n", strerror(errno));
+	watch(reader.evfd, NULL);
+}
+
+static bool
+reader_add(Client *c) {
+	Ring *r = &c->ring;
+	if (!(r->buf = malloc(READ_BUFFER_SIZE)))
+		return false;
+	r->size = READ_BUFFER_SIZE;
+	pthread_mutex_lock(&reader.lock);
+	if (c->pty >= reader.nclients) {
+		int n = max(c->pty + 1, 2 * reader.nclients);
+		Client **clients = realloc(reader.clients, n * sizeof(*clients));
+		if (!clients) {
+			pthread_mutex_unlock(&reader.lock);
+			free(r->buf);
+			return false;
+		}
+		memset(clients + reader.nclients, 0, (n - reader.nclients) * sizeof(*clients));
+		reader.clients = clients;
+		reader.nclients = n;
+	}
+	reader.clients[c->pty] = c;
+	pthread_mutex_unlock(&reader.lock);
+	reader_watch(c->pty);
+	return true;
+}
+
+static void
+reader_remove(Client *c) {
+	epoll_ctl(reader.epfd, EPOLL_CTL_DEL, c->pty, NULL);
+	/* once the lock is acquired the reader is no longer using the client */
+	pthread_mutex_lock(&reader.lock);
+	reader.clients[c->pty] = NULL;
+	pthread_mutex_unlock(&reader.lock);
+	free(c->ring.buf);
+}
+
+/* parses up to the client's budget from its ring, returns -1 once the
+ * pty was closed and everything got processed, 1 if data is left */
+static int
+ring_consume(Client *c) {
+	Ring *r = &c->ring;
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), tail = r->tail;
+	size_t budget = PROCESS_BUDGET * (20 - c->nice) / 20;
+	bool full = false;
+
+	if (head == tail)
+		return __atomic_load_n(&r->error, __ATOMIC_ACQUIRE) ? -1 : 0;
+
+	while (tail != head && budget > 0) {
+		size_t off = tail & (r->size - 1);
+		size_t len = min(min(head - tail, r->size - off), budget);
+		size_t n = vt_feed(c->term, r->buf + off, len);
+		if (n == 0) {
+			/* copy mode holds back as much as it may, the rest
+			 * stays in the ring until it ends */
+			full = true;
+			break;
+		}
+		tail += n;
+		budget -= n;
+	}
+	c->dirty = true;
+	__atomic_store_n(&r->tail, tail, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->stalled, __ATOMIC_SEQ_CST) &&
+	    __atomic_exchange_n(&r->stalled, 0, __ATOMIC_SEQ_CST))
+		reader_watch(c->pty);
+	return tail != head && !full;
+}
+
+static void
+run_jobs() {
+	int i;
+	while ((i = __atomic_fetch_add(&workers.next, 1, __ATOMIC_RELAXED)) < workers.count)
+		workers.results[i] = ring_consume(workers.jobs[i]);
+}
+
+static void *
+worker_thread(void *arg) {
+	unsigned round = 0;
+	pthread_mutex_lock(&workers.lock);
+	for (;;) {
+		while (workers.round == round)
+			pthread_cond_wait(&workers.wakeup, &workers.lock);
+		round = workers.round;
+		pthread_mutex_unlock(&workers.lock);
+		run_jobs();
+		pthread_mutex_lock(&workers.lock);
+		if (--workers.busy == 0)
+			pthread_cond_signal(&workers.finished);
+	}
+	return NULL;
+}
+
+static void
+workers_init() {
+	int threads = PARSE_THREADS;
+	if (threads < 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	pthread_mutex_init(&workers.lock, NULL);
+	pthread_cond_init(&workers.wakeup, NULL);
+	pthread_cond_init(&workers.finished, NULL);
+	for (; workers.threads < threads; workers.threads++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, worker_thread, NULL))
+			break;
+		pthread_detach(thread);
+	}
+}
+
+static void
+workers_add(Client *c) {
+	if (workers.count == workers.size) {
+		int size = workers.size ? 2 * workers.size : 16;
+		Client **jobs = realloc(workers.jobs, size * sizeof(*jobs));
+		if (!jobs)
+			error("out of memory\n");
+		workers.jobs = jobs;
+		int *results = realloc(workers.results, size * sizeof(*results));
+		if (!results)
+			error("out of memory\n");
+		workers.results = results;
+		workers.size = size;
+	}
+	workers.jobs[workers.count++] = c;
+}
+
+/* returns once all added jobs are completed */
+static void
+workers_run() {
+	workers.next = 0;
+	if (workers.threads == 0 || workers.count < 2) {
+		run_jobs();
+		return;
+	}
+	pthread_mutex_lock(&workers.lock);
+	workers.busy = workers.threads;
+	workers.round++;
+	pthread_cond_broadcast(&workers.wakeup);
+	pthread_mutex_unlock(&workers.lock);
+	run_jobs();
+	pthread_mutex_lock(&workers.lock);
+	while (workers.busy)
+		pthread_cond_wait(&workers.finished, &workers.lock);
+	pthread_mutex_unlock(&workers.lock);
+}
+#endif
+
+/* forget what was drawn for the client, its screen area got overwritten */
+static void
+invalidate(Client *c) {
+	/* a client being created is arranged before its terminal exists */
+	if (c->term)
+		vt_dirty(c->term);
+	c->border.width = 0;
+	c->dirty = true;
+}
+
+/* writes the input queued for the client, its pty is watched for
+ * writability as long as the application does not accept all of it */
+static void
+flush_client(Client *c) {
+	vt_flush(c->term);
+	watch_output(c->pty, c, vt_write_pending(c->term));
+}
+
+/* blanks the workspace, all clients thus have to be redrawn */
 static void
 clear_workspace() {
+	attrset(NORMAL_ATTR);
 	for (unsigned int y = 0; y < wah; y++)
 		mvhline(way + y, 0, ' ', waw);
+	for (Client *c = clients; c; c = c->next)
+		invalidate(c);
+}
+
+/* the host additionally reports motion while a button is held (mode 1002)
+ * or, if the focused application asked for it, all of it (mode 1003). The
+ * sequence is derived from XM, which curses uses to enable the mouse */
+static void
+mouse_motion() {
+#ifdef CONFIG_MOUSE
+	static int current;
+	char seq[64], *xm = tigetstr("XM"), *p;
+	int mode = !input.mask ? 0 : sel && sel->term && vt_mousetrack(sel->term) == 1003 ? 1003 : 1002;
+
+	if (mode == current)
+		return;
+	int m = mode ? mode : current;
+	current = mode;
+	if (xm && xm != (char *)-1 && (p = strstr(xm, "1000")) && strlen(xm) < sizeof seq) {
+		snprintf(seq, sizeof seq, "%.*s%d%s", (int)(p - xm), xm, m, p + 4);
+		putp(tparm(seq, mode ? 1 : 0));
+	} else {
+		snprintf(seq, sizeof seq, "\e[?%d%c", m, mode ? 'h' : 'l');
+		putp(seq);
+	}
+	fflush(stdout);
+#endif /* CONFIG_MOUSE */
+}
+
+/* the cursor is only shown in the selected client, its visibility is
+ * changed at most once per frame and only if it actually differs from
+ * what the terminal currently displays */
+static void
+update_screen() {
+	bool visible = sel && !sel->unplaced && (!sel->minimized || isarrange(fullscreen)) && vt_cursor(sel->term);
+	/* only frames which actually changed some cells are synchronized */
+	bool sync = sync_begin && is_wintouched(stdscr);
+
+	/* curses flushes its output buffer after each of the calls below,
+	 * the synchronization markers are thus written directly */
+	if (sync)
+		write(STDOUT_FILENO, sync_begin, strlen(sync_begin));
+	if (!visible && cursor_visible != 0 && curs_set(0) != ERR)
+		cursor_visible = 0;
+	mouse_motion();
+	/* the physical cursor ends up where render() left the one of stdscr */
 	wnoutrefresh(stdscr);
+	doupdate();
+	if (visible && cursor_visible != 1 && curs_set(1) != ERR)
+		cursor_visible = 1;
+	if (sync)
+		write(STDOUT_FILENO, sync_end, strlen(sync_end));
 }
 
 static void
 drawbar() {
 	wchar_t wbuf[sizeof bar.text];
+	const char *text = bar.notice[0] ? bar.notice : bar.text;
 	int w, maxwidth = screen.w - 2;
-	if (bar.pos == BAR_OFF || !bar.text[0])
+	if (bar.pos == BAR_OFF)
+		return;
+	if (!text[0]) {
+		/* wipes an expired notice */
+		attrset(NORMAL_ATTR);
+		mvhline(bar.y, 0, ' ', screen.w);
 		return;
-	curs_set(0);
+	}
 	attrset(BAR_ATTR);
 	mvaddch(bar.y, 0, '[');
-	if (mbstowcs(wbuf, bar.text, sizeof bar.text) == (size_t)-1)
+	if (mbstowcs(wbuf, text, sizeof bar.text) == (size_t)-1)
 		return;
 	if ((w = wcswidth(wbuf, maxwidth)) == -1)
 		return;
@@ -248,27 +911,30 @@ drawbar() {
 		for (int i = 0; i + w < maxwidth; i++)
 			addch(' ');
 	}
-	addstr(bar.text);
+	addstr(text);
 	if (BAR_ALIGN == ALIGN_LEFT) {
 		for (; w < maxwidth; w++)
 			addch(' ');
 	}
 	mvaddch(bar.y, screen.w - 1, ']');
 	attrset(NORMAL_ATTR);
-	if (sel)
-		curs_set(vt_cursor(sel->term));
-	refresh();
+}
+
+/* shows msg in the status bar for NOTICE_TIMEOUT milliseconds */
+static void
+notice(const char *msg) {
+	snprintf(bar.notice, sizeof bar.notice, "%s", msg);
+	clock_gettime(CLOCK_MONOTONIC, &bar.noticed);
+	drawbar();
 }
 
 static void
 draw_border(Client *c) {
-	char t = '\0';
-	int x, y, maxlen;
+	char t = '\0', text[sizeof(c->border.text)];
+	int x, y, maxlen, col = 0, end;
+	size_t pos = 0;
+	attr_t attrs = (sel == c || (runinall && !c->minimized)) ? SELECTED_ATTR : NORMAL_ATTR;
 
-	wattrset(c->window, (sel == c || (runinall && !c->minimized)) ? SELECTED_ATTR : NORMAL_ATTR);
-	getyx(c->window, y, x);
-	curs_set(0);
-	mvwhline(c->window, 0, 0, ACS_HLINE, c->w);
 	maxlen = c->w - (2 + sstrlen(TITLE) - sstrlen("%s%sd")  + sstrlen(SEPARATOR) + 2);
 	if (maxlen < 0)
 		maxlen = 0;
@@ -277,86 +943,312 @@ draw_border(Client *c) {
 		c->title[maxlen] = '\0';
 	}
 
-	mvwprintw(c->window, 0, 2, TITLE,
-	          *c->title ? c->title : "",
-	          *c->title ? SEPARATOR : "",
-	          c->order);
+	snprintf(text, sizeof text, TITLE,
+	         *c->title ? c->title : "",
+	         *c->title ? SEPARATOR : "",
+	         c->order);
 	if (t)
 		c->title[maxlen] = t;
-	wmove(c->window, y, x);
-	if (!c->minimized)
-		curs_set(vt_cursor(c->term));
+
+	if (c->border.width == c->w && c->border.attrs == attrs && !strcmp(c->border.text, text))
+		return;
+
+	attrset(attrs);
+	getyx(stdscr, y, x);
+	if (c->border.width != c->w || c->border.attrs != attrs) {
+		mvhline(c->y, c->x, ACS_HLINE, c->w);
+		c->border.end = 0;
+	} else {
+		/* skip the characters which are already on screen */
+		mbstate_t ps;
+		memset(&ps, 0, sizeof(ps));
+		for (;;) {
+			wchar_t wc;
+			size_t len = mbrtowc(&wc, text + pos, MB_CUR_MAX, &ps);
+			if (len == 0 || len == (size_t)-1 || len == (size_t)-2 ||
+			    strncmp(text + pos, c->border.text + pos, len))
+				break;
+			pos += len;
+			col += max(wcwidth(wc), 0);
+		}
+	}
+
+	/* the title is clipped to the client, it would otherwise
+	 * spill over into the neighbouring one */
+	end = 2 + col;
+	move(c->y, c->x + end);
+	mbstate_t ps;
+	memset(&ps, 0, sizeof(ps));
+	for (const char *s = text + pos; *s; ) {
+		wchar_t wc;
+		size_t len = mbrtowc(&wc, s, MB_CUR_MAX, &ps);
+		if (len == 0 || len == (size_t)-1 || len == (size_t)-2)
+			break;
+		int w = max(wcwidth(wc), 0);
+		if (end + w > c->w)
+			break;
+		addnstr(s, len);
+		s += len;
+		end += w;
+	}
+	if (end < c->border.end)
+		hline(ACS_HLINE, c->border.end - end);
+
+	strcpy(c->border.text, text);
+	c->border.attrs = attrs;
+	c->border.width = c->w;
+	c->border.end = end;
+	move(y, x);
 }
 
 static void
 draw_content(Client *c) {
-	if (!c->minimized || isarrange(fullscreen)) {
-		vt_draw(c->term, c->window, 1, 0);
-		if (c != sel)
-			curs_set(0);
-	}
+	if (!c->minimized || isarrange(fullscreen))
+		vt_draw(c->term, stdscr, c->y + 1, c->x);
 }
 
 static void
 draw(Client *c) {
 	draw_content(c);
 	draw_border(c);
-	wrefresh(c->window);
+	c->dirty = false;
 }
 
+/* commands and event handlers merely mark the affected clients as dirty
+ * or request a redraw of the whole workspace, the actual drawing happens
+ * here once per main loop iteration and results in a single doupdate().
+ * All clients draw directly into stdscr at their position, curses takes
+ * care of sending the cells which actually changed */
 static void
-draw_all(bool border) {
+render() {
 	Client *c;
-	curs_set(0);
 	for (c = clients; c; c = c->next) {
-		redrawwin(c->window);
-		if (c == sel)
+		/* in fullscreen mode the other clients are hidden */
+		if (c == sel || isarrange(fullscreen) || c->unplaced || (!c->dirty && !redraw_all))
 			continue;
-		draw_content(c);
-		if (border)
-			draw_border(c);
-		wnoutrefresh(c->window);
+		draw(c);
 	}
-	/* as a last step the selected window is redrawn,
+	/* as a last step the selected client is redrawn,
 	 * this has the effect that the cursor position is
 	 * accurate
 	 */
-	refresh();
-	if (sel) {
-		draw_content(sel);
-		if (border)
-			draw_border(sel);
-		wrefresh(sel->window);
+	if (sel && !sel->unplaced)
+		draw(sel);
+	redraw_all = false;
+	update_screen();
+}
+
+static bool
+event_wanted(char type) {
+	for (Subscriber *s = subscribers; s; s = s->next) {
+		if (s->mask & 1u << (type - 'A'))
+			return true;
 	}
+	return false;
 }
 
 static void
-arrange_event() {
-	if (evtfifo.fd != -1) {
-		Client *c;
-		char prefix = 'A';
-		write(evtfifo.fd, &prefix, 1);
-		for (c = clients; c; c = c->next) {
-			char buf[128];
-			int end = snprintf(buf, sizeof(buf),
-				"|%d,%d,%d,%d,%d,%d,%d,%d",
-				c->id, c->x, c->y, c->w, c->h,
-				c == sel, c->minimized, c->died);
-			write(evtfifo.fd, buf, end);
+queue_add(Subscriber *s, const char *str, size_t len) {
+	if (s->truncated || s->len + len > sizeof(s->buf)) {
+		s->truncated = true;
+		return;
+	}
+	size_t end = (s->start + s->len) % sizeof(s->buf);
+	size_t n = min(len, sizeof(s->buf) - end);
+	memcpy(s->buf + end, str, n);
+	memcpy(s->buf, str + n, len - n);
+	s->len += len;
+}
+
+/* reports the number of lost records, but only once the reader caught
+ * up with half of the queue rather than for every record that fits */
+static bool
+queue_dropped(Subscriber *s) {
+	char rec[32];
+	if (!s->dropped)
+		return true;
+	if (s->len > sizeof(s->buf) / 2)
+		return false;
+	int len = snprintf(rec, sizeof rec, "O|%u\n", s->dropped);
+	queue_add(s, rec, len);
+	s->dropped = 0;
+	return true;
+}
+
+/* starts a record for the subscribers of its type or only for to,
+ * it is queued as a whole or not at all */
+static void
+event_begin(char type, Subscriber *to) {
+	for (Subscriber *s = subscribers; s; s = s->next) {
+		s->active = to ? s == to : !!(s->mask & 1u << (type - 'A'));
+		if (!s->active)
+			continue;
+		s->truncated = !queue_dropped(s);
+		s->mark = s->len;
+		queue_add(s, &type, 1);
+	}
+}
+
+static void
+event_add(const char *str, size_t len) {
+	for (Subscriber *s = subscribers; s; s = s->next) {
+		if (s->active)
+			queue_add(s, str, len);
+	}
+}
+
+static void
+event_end() {
+	for (Subscriber *s = subscribers; s; s = s->next) {
+		if (!s->active)
+			continue;
+		queue_add(s, "\n", 1);
+		if (s->truncated) {
+			s->len = s->mark;
+			s->truncated = false;
+			s->dropped++;
+		}
+		s->active = false;
+	}
+}
+
+/* writes what the reader accepts, the rest waits for writability,
+ * returns false if the reader is gone */
+static bool
+queue_flush(Subscriber *s) {
+	queue_dropped(s);
+	while (s->len) {
+		struct iovec iov[2];
+		size_t len = s->len, n;
+		if (s->packets) {
+			for (len = 0; s->buf[(s->start + len) % sizeof(s->buf)] != '\n'; len++);
+			len++;
+		}
+		n = min(len, sizeof(s->buf) - s->start);
+		iov[0] = (struct iovec){ s->buf + s->start, n };
+		iov[1] = (struct iovec){ s->buf, len - n };
+		ssize_t res;
+		if (s->packets) {
+			struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iov[1].iov_len ? 2 : 1 };
+			res = sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+		} else {
+			res = writev(s->fd, iov, iov[1].iov_len ? 2 : 1);
+		}
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return false;
 		}
-		char newline = '\n';
-		write(evtfifo.fd, &newline, 1);
+		s->start = (s->start + res) % sizeof(s->buf);
+		s->len -= res;
+	}
+	watch_output(s->fd, s, s->len > 0);
+	return true;
+}
+
+static Subscriber*
+get_subscriber(int fd) {
+	for (Subscriber *s = subscribers; s; s = s->next) {
+		if (s->fd == fd)
+			return s;
+	}
+	return NULL;
+}
+
+static void
+control_close(Subscriber *s) {
+	Subscriber **p = &subscribers;
+	while (*p != s)
+		p = &(*p)->next;
+	*p = s->next;
+	if (requester == s)
+		requester = NULL;
+	/* the batches left open by a client which went away are committed */
+	for (; s->batches > 0; s->batches--)
+		batchcommit(NULL);
+	unwatch(s->fd);
+	close(s->fd);
+	free(s);
+	control.count--;
+}
+
+static void
+subscriber_flush(Subscriber *s) {
+	if (queue_flush(s))
+		return;
+	if (s == &fifosub)
+		s->len = 0;
+	else
+		control_close(s);
+}
+
+static void
+events_flush() {
+	for (Subscriber *s = subscribers, *next; s; s = next) {
+		next = s->next;
+		subscriber_flush(s);
+	}
+}
+
+/* the layout for all subscribers or only for to */
+static void
+layout_event(Subscriber *to) {
+	if (!to && !event_wanted('A'))
+		return;
+	event_begin('A', to);
+	for (Client *c = clients; c; c = c->next) {
+		char buf[128];
+		int end = snprintf(buf, sizeof(buf),
+			"|%d,%d,%d,%d,%d,%d,%d,%d",
+			c->id, c->x, c->y, c->w, c->h,
+			c == sel, c->minimized, c->died);
+		event_add(buf, end);
+	}
+	event_end();
+}
+
+static void
+arrange_event() {
+	if (batch.depth) {
+		batch.arrange = true;
+		return;
 	}
+	layout_event(NULL);
 }
 
 static void
 arrange() {
-	clear_workspace();
+	if (batch.depth) {
+		batch.arrange = true;
+		return;
+	}
+	/* the layouts cover the whole workspace, clients whose area
+	 * changed are completely redrawn by resize() */
+	if (!clients)
+		clear_workspace();
 	attrset(NORMAL_ATTR);
 	layout->arrange();
+	for (Client *c = clients; c; c = c->next)
+		c->unplaced = false;
 	arrange_event();
-	wnoutrefresh(stdscr);
-	draw_all(true);
+	redraw_all = true;
+}
+
+/* assigns the clients created in an open batch the area they will get once
+ * it is committed, neither the other clients nor the screen are changed */
+static void
+place() {
+	WINDOW *save = dupwin(stdscr);
+	if (!save)
+		return;
+	placing = true;
+	layout->arrange();
+	placing = false;
+	/* the layouts draw the separators between the clients */
+	overwrite(save, stdscr);
+	delwin(save);
 }
 
 static void
@@ -419,14 +1311,11 @@ focus(Client *c) {
 		return;
 	sel = c;
 	settitle(c);
-	if (tmp) {
-		draw_border(tmp);
-		wrefresh(tmp->window);
-	}
+	if (tmp)
+		tmp->dirty = true;
 	if (isarrange(fullscreen))
-		redrawwin(c->window);
-	draw_border(c);
-	wrefresh(c->window);
+		invalidate(c);
+	c->dirty = true;
 	arrange_event();
 }
 
@@ -458,7 +1347,7 @@ term_event_handler(Vt *term, int event, void *event_data) {
 			strncpy(c->title, event_data, sizeof(c->title) - 1);
 		c->title[event_data ? sizeof(c->title) - 1 : 0] = '\0';
 		settitle(c);
-		draw_border(c);
+		c->dirty = true;
 		applycolorrules(c);
 		break;
 	case VT_EVENT_COPY_TEXT:
@@ -475,12 +1364,9 @@ move_client(Client *c, int x, int y) {
 	if (c->x == x && c->y == y)
 		return;
 	debug("moving, x: %d y: %d\n", x, y);
-	if (mvwin(c->window, y, x) == ERR)
-		eprint("error moving, x: %d y: %d\n", x, y);
-	else {
-		c->x = x;
-		c->y = y;
-	}
+	c->x = x;
+	c->y = y;
+	invalidate(c);
 }
 
 static void
@@ -488,17 +1374,17 @@ resize_client(Client *c, int w, int h) {
 	if (c->w == w && c->h == h)
 		return;
 	debug("resizing, w: %d h: %d\n", w, h);
-	if (wresize(c->window, h, w) == ERR)
-		eprint("error resizing, w: %d h: %d\n", w, h);
-	else {
-		c->w = w;
-		c->h = h;
-	}
-	vt_resize(c->term, h - 1, w);
+	/* the terminal follows once per main loop round, only the final
+	 * geometry of all the layout changes in between thus reaches it */
+	c->w = w;
+	c->h = h;
+	invalidate(c);
 }
 
 static void
 resize(Client *c, int x, int y, int w, int h) {
+	if (placing && !c->unplaced)
+		return;
 	resize_client(c, w, h);
 	move_client(c, x, y);
 }
@@ -510,6 +1396,10 @@ get_client_by_pid(pid_t pid) {
 		if (c->pid == pid)
 			return c;
 	}
+	for (c = pool.clients; c; c = c->next) {
+		if (c->pid == pid)
+			return c;
+	}
 	return NULL;
 }
 
@@ -529,9 +1419,9 @@ get_client_by_coord(unsigned int x, unsigned int y) {
 	return NULL;
 }
 
+/* only called from the main loop, never in signal context */
 static void
-sigchld_handler(int sig) {
-	int errsv = errno;
+reap() {
 	int status;
 	pid_t pid;
 	Client *c;
@@ -549,13 +1439,17 @@ sigchld_handler(int sig) {
 		if ((c = get_client_by_pid(pid)))
 			c->died = true;
 	}
+}
 
-	errno = errsv;
+static void
+sigchld_handler(int sig) {
+	children_died = true;
 }
 
 static void
 sigwinch_handler(int sig) {
 	screen.need_resize = true;
+	clock_gettime(CLOCK_MONOTONIC, &screen.resized);
 }
 
 static void
@@ -563,6 +1457,37 @@ sigterm_handler(int sig) {
 	running = false;
 }
 
+#ifdef HAVE_SIGNALFD
+static void
+handle_signals() {
+	struct signalfd_siginfo info;
+
+	while (read(sigfd, &info, sizeof info) == sizeof info) {
+		switch (info.ssi_signo) {
+		case SIGWINCH:
+			sigwinch_handler(SIGWINCH);
+			break;
+		case SIGCHLD:
+			sigchld_handler(SIGCHLD);
+			break;
+		case SIGTERM:
+			sigterm_handler(SIGTERM);
+			break;
+		}
+	}
+}
+#endif
+
+static int
+open_pidfd(pid_t pid) {
+#if defined(HAVE_SIGNALFD) && defined(SYS_pidfd_open)
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 static void
 updatebarpos(void) {
 	bar.y = 0;
@@ -595,12 +1520,13 @@ resize_screen() {
 
 	resizeterm(screen.h, screen.w);
 	wresize(stdscr, screen.h, screen.w);
-	wrefresh(curscr);
-	refresh();
+	/* repaint the whole terminal with the next update */
+	clearok(curscr, TRUE);
 
 	waw = screen.w;
 	wah = screen.h;
 	updatebarpos();
+	clear_workspace();
 	drawbar();
 	arrange();
 }
@@ -650,56 +1576,385 @@ escapestring(char *dst, const char *src, int len) {
 }
 
 static void
-keypress(int code) {
+keypress(int code, const char *seq, size_t len) {
 	Client *c;
-	unsigned int len = 1;
-	char buf[8] = { '\e' };
+	char key = code;
+
+	if (!seq) {
+		seq = &key;
+		len = 1;
+	}
+
+	for (c = runinall ? clients : sel; c; c = c->next) {
+		if (!c->minimized || isarrange(fullscreen)) {
+			if (code == '\e') {
+				/* pass unknown sequences to the underlying app as they are */
+				if (inputmode & PIPE_ESCAPE && event_wanted('E')) {
+					char bufesc[INPUT_SEQ_MAX*4];
+					event_begin('E', NULL);
+					event_add(bufesc, escapestring(bufesc, seq, len));
+					event_end();
+				} else
+					/* like any key, dropped once the application
+					 * left a full queue of its input unread */
+					vt_write(c->term, seq, len);
+			} else {
+				if (inputmode & PIPE_INPUT && event_wanted('K')) {
+					char bufesc[INPUT_SEQ_MAX*4];
+					event_begin('K', NULL);
+					event_add(bufesc, escapestring(bufesc, seq, len));
+					event_end();
+				} else
+					vt_keypress(c->term, code);
+			}
+		}
+		if (!runinall)
+			break;
+	}
+}
+
+static void
+mouse_setup() {
+#ifdef CONFIG_MOUSE
+	mmask_t mask = 0;
+
+	if (mouse_events_enabled) {
+		mask = BUTTON1_CLICKED | BUTTON2_CLICKED;
+		for (unsigned int i = 0; i < countof(buttons); i++)
+			mask |= buttons[i].mask;
+	}
+	mousemask(mask, NULL);
+	input.mask = mask;
+	mouse_motion();
+#endif /* CONFIG_MOUSE */
+}
+
+/* the terminfo capabilities of the keys vt_keypress knows how to translate */
+static const struct {
+	const char *cap;
+	int code;
+} terminfo_keys[] = {
+	{ "kcuu1", KEY_UP        },
+	{ "kcud1", KEY_DOWN      },
+	{ "kcub1", KEY_LEFT      },
+	{ "kcuf1", KEY_RIGHT     },
+	{ "kLFT",  KEY_SLEFT     },
+	{ "kRIT",  KEY_SRIGHT    },
+	{ "kbs",   KEY_BACKSPACE },
+	{ "kich1", KEY_IC        },
+	{ "kdch1", KEY_DC        },
+	{ "kpp",   KEY_PPAGE     },
+	{ "knp",   KEY_NPAGE     },
+	{ "khome", KEY_HOME      },
+	{ "kend",  KEY_END       },
+};
+
+static long
+elapsed(const struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 +
+	       (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void
+input_bind(const char *seq, int code) {
+	KeyNode **n = &input.keys, *k = NULL;
+
+	for (const unsigned char *s = (const unsigned char *)seq; *s; s++) {
+		for (k = *n; k && k->byte != *s; k = k->next);
+		if (!k) {
+			if (!(k = calloc(1, sizeof *k)))
+				return;
+			k->byte = *s;
+			k->next = *n;
+			*n = k;
+		}
+		n = &k->child;
+	}
+	if (k && !k->code)
+		k->code = code;
+}
+
+static void
+input_init() {
+	char cap[8], *seq;
+
+	for (unsigned int i = 0; i < countof(terminfo_keys); i++) {
+		seq = tigetstr(terminfo_keys[i].cap);
+		if (seq && seq != (char *)-1)
+			input_bind(seq, terminfo_keys[i].code);
+	}
+	for (int i = 1; i <= 22; i++) {
+		snprintf(cap, sizeof cap, "kf%d", i);
+		seq = tigetstr(cap);
+		if (seq && seq != (char *)-1)
+			input_bind(seq, KEY_F(i));
+	}
+	/* cursor keys of terminals ignoring the keypad transmit mode */
+	const int cursor[] = { KEY_UP, KEY_DOWN, KEY_RIGHT, KEY_LEFT };
+	for (unsigned int i = 0; i < countof(cursor); i++) {
+		char csi[] = { '\e', '[', 'A' + i, '\0' }, ss3[] = { '\e', 'O', 'A' + i, '\0' };
+		input_bind(csi, cursor[i]);
+		input_bind(ss3, cursor[i]);
+	}
+}
+
+#ifdef CONFIG_MOUSE
+/* turns a mouse report into an event for the application under the pointer
+ * in input.mouse and one for the key bindings in input.clicks. The latter
+ * follows the curses conventions, a press and release in quick succession
+ * make up a click which is only reported if it is part of input.mask */
+static int
+mouse_decode(int b, int x, int y, bool release) {
+	static const mmask_t masks[][4] = {
+		{ BUTTON1_PRESSED, BUTTON1_RELEASED, BUTTON1_CLICKED, BUTTON1_DOUBLE_CLICKED },
+		{ BUTTON2_PRESSED, BUTTON2_RELEASED, BUTTON2_CLICKED, BUTTON2_DOUBLE_CLICKED },
+		{ BUTTON3_PRESSED, BUTTON3_RELEASED, BUTTON3_CLICKED, BUTTON3_DOUBLE_CLICKED },
+	};
+	int button = (b & 3) + 1, interval = mouseinterval(-1);
+	mmask_t state = 0, clicks = 0, mods = 0;
+
+	if (b & 64) {
+		/* wheel, reported as press of buttons 4 and 5 */
+		if (button == 1)
+			state = BUTTON4_PRESSED;
+#ifdef BUTTON5_PRESSED
+		else if (button == 2)
+			state = BUTTON5_PRESSED;
+#endif
+		clicks = state;
+	} else if (b & 32) {
+		/* motion while a button is held or, in mode 1003, without */
+		state = REPORT_MOUSE_POSITION;
+		if (input.button)
+			state |= masks[input.button-1][0];
+	} else if (!release && button <= 3) {
+		input.twice = input.clicked == button && elapsed(&input.released) <= interval;
+		input.button = button;
+		clock_gettime(CLOCK_MONOTONIC, &input.pressed);
+		state = clicks = masks[button-1][0];
+	} else if (input.button) {
+		button = input.button;
+		input.button = 0;
+		input.clicked = 0;
+		state = clicks = masks[button-1][1];
+		if (elapsed(&input.pressed) <= interval) {
+			if (input.twice && (input.mask & masks[button-1][3])) {
+				clicks = masks[button-1][3];
+			} else {
+				clicks = masks[button-1][2];
+				input.clicked = button;
+				clock_gettime(CLOCK_MONOTONIC, &input.released);
+			}
+		}
+	}
+
+	if (!state)
+		return ERR;
+	if (b & 4)
+		mods |= BUTTON_SHIFT;
+	if (b & 8)
+		mods |= BUTTON_ALT;
+	if (b & 16)
+		mods |= BUTTON_CTRL;
+	input.clicks = clicks & input.mask ? (clicks & input.mask) | mods : 0;
+	input.mouse = (MEVENT){ .x = x, .y = y, .bstate = state | mods };
+	return KEY_MOUSE;
+}
+#endif /* CONFIG_MOUSE */
 
-	if (code == '\e') {
-		/* pass characters following escape to the underlying app */
-		nodelay(stdscr, TRUE);
-		for (int t; len < sizeof(buf) && (t = getch()) != ERR; len++)
-			buf[len] = t;
-		nodelay(stdscr, FALSE);
+/* determines the length of the key at the start of the input buffer, 0 if
+ * it is incomplete. Known keys yield their curses code, other sequences
+ * '\e' and single bytes themselves. Incomplete sequences are returned as
+ * they are if flush is set, a lone escape always is. */
+static size_t
+input_decode(int *code, bool flush) {
+	unsigned char *s = input.buf + input.start;
+	size_t len = input.len - input.start, n = 0, i;
+	bool partial = false;
+
+	if (!len)
+		return 0;
+
+	/* longest match among the known keys */
+	KeyNode *k = input.keys;
+	for (i = 0; i < len && k; ) {
+		for (; k && k->byte != s[i]; k = k->next);
+		if (!k)
+			break;
+		if (k->code) {
+			n = i + 1;
+			*code = k->code;
+		}
+		k = k->child;
+		partial = ++i == len && k;
 	}
+	if (n && (!partial || flush))
+		return n;
+	if (partial && !flush && len > 1)
+		return 0;
+
+	/* Enter is reported as '\n' like curses does in nl mode,
+	 * vt_keypress turns it back into a carriage return */
+	*code = s[0] == '\r' ? '\n' : s[0];
+	if (s[0] != '\e' || len == 1)
+		return 1;
+
+	*code = '\e';
+	switch (s[1]) {
+	case '[':
+		if (len > 2 && s[2] == 'M') {
+			/* X10 mouse report: button, column and row offset by 32 */
+			if (len < 6)
+				break;
+#ifdef CONFIG_MOUSE
+			*code = mouse_decode(s[3] - 32, s[4] - 33, s[5] - 33, (s[3] & 3) == 3);
+#else
+			*code = ERR;
+#endif
+			return 6;
+		}
+		/* fall through */
+	case 'O':
+		/* parameter, intermediate and final bytes of CSI and SS3 */
+		for (i = 2; i < len && s[i] >= 0x30 && s[i] <= 0x3f; i++);
+		for (; i < len && s[i] >= 0x20 && s[i] <= 0x2f; i++);
+		if (i == len)
+			break;
+		n = s[i] >= 0x40 && s[i] <= 0x7e ? i + 1 : i;
+		if (n > INPUT_SEQ_MAX)
+			n = INPUT_SEQ_MAX;
+		if (s[1] == '[' && s[2] == '<' && (s[n-1] == 'M' || s[n-1] == 'm')) {
+			/* SGR mouse report: button;column;row terminated by M or m on release */
+			int p[3] = { 0 }, np = 0;
+			for (i = 3; i < n - 1 && np < 3; i++) {
+				if (s[i] == ';')
+					np++;
+				else
+					p[np] = p[np] * 10 + s[i] - '0';
+			}
+#ifdef CONFIG_MOUSE
+			*code = mouse_decode(p[0], p[1] - 1, p[2] - 1, s[n-1] == 'm');
+#else
+			*code = ERR;
+#endif
+		}
+		return n;
+	case '\e':
+		return 1;
+	default:
+		/* meta modified key */
+		return 2;
+	}
+
+	if (!flush && len < INPUT_SEQ_MAX)
+		return 0;
+	return min(len, INPUT_SEQ_MAX);
+}
+
+/* removes the next key from the input buffer and stores its bytes in seq */
+static size_t
+input_key(int *code, char *seq, bool flush) {
+	size_t len = input_decode(code, flush);
+
+	if (!len) {
+		if (input.start < input.len && !input.incomplete) {
+			input.incomplete = true;
+			clock_gettime(CLOCK_MONOTONIC, &input.since);
+		}
+		return 0;
+	}
+	input.incomplete = false;
+	memcpy(seq, input.buf + input.start, len);
+	input.start += len;
+	if (input.start == input.len)
+		input.start = input.len = 0;
+	return len;
+}
+
+/* milliseconds until an incomplete sequence is passed on as is, -1 if none */
+static int
+input_timeout() {
+	if (!input.incomplete)
+		return -1;
+	return max(ESCDELAY - elapsed(&input.since), 0);
+}
+
+static bool
+input_read() {
+	ssize_t n;
+
+	if (input.start) {
+		input.len -= input.start;
+		memmove(input.buf, input.buf + input.start, input.len);
+		input.start = 0;
+	}
+	while ((n = read(STDIN_FILENO, input.buf + input.len, sizeof input.buf - input.len)) == -1 && errno == EINTR);
+	if (n <= 0)
+		return false;
+	input.len += n;
+	return true;
+}
+
+static bool
+input_pending() {
+	struct pollfd fd = { .fd = STDIN_FILENO, .events = POLLIN };
+	return input.len < sizeof input.buf && poll(&fd, 1, 0) == 1;
+}
 
-	for (c = runinall ? clients : sel; c; c = c->next) {
-		if (!c->minimized || isarrange(fullscreen)) {
-			if (code == '\e') {
-				if (inputmode & PIPE_ESCAPE && evtfifo.fd != -1) {
-					char bufesc[sizeof(buf)*4+2] = { 'E' };
-					int lenesc = escapestring(bufesc+1, buf, len)+2;
-					bufesc[lenesc-1] = '\n';
-					write(evtfifo.fd, bufesc, lenesc);
-				} else
-					vt_write(c->term, buf, len);
-			} else {
-				if (inputmode & PIPE_INPUT && evtfifo.fd != -1) {
-					char bufesc[6] = { 'K' }; char c = (char)code;
-					int lenesc = escapestring(bufesc+1, &c, 1)+2;
-					bufesc[lenesc-1] = '\n';
-					write(evtfifo.fd, bufesc, lenesc);
-				} else
-					vt_keypress(c->term, code);
-			}
+/* blocks until the next key arrives */
+static int
+readkey() {
+	char seq[INPUT_SEQ_MAX];
+	int code;
+
+	for (;;) {
+		if (input_key(&code, seq, false)) {
+			if (code != ERR)
+				return code;
+			continue;
 		}
-		if (!runinall)
+		/* like getch, show what was drawn before waiting for the key */
+		if (is_wintouched(stdscr))
+			refresh();
+		struct pollfd fd = { .fd = STDIN_FILENO, .events = POLLIN };
+		switch (poll(&fd, 1, input_timeout())) {
+		case 0:
+			if (input_key(&code, seq, true) && code != ERR)
+				return code;
+			break;
+		case 1:
+			if (!input_read())
+				return ERR;
 			break;
+		}
 	}
 }
 
-static void
-mouse_setup() {
-#ifdef CONFIG_MOUSE
-	mmask_t mask = 0;
+static unsigned int
+hash(const char *s) {
+	unsigned int h = 2166136261u;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
 
-	if (mouse_events_enabled) {
-		mask = BUTTON1_CLICKED | BUTTON2_CLICKED;
-		for (unsigned int i = 0; i < countof(buttons); i++)
-			mask |= buttons[i].mask;
+/* indexes the commands by name, open addressing with linear probing */
+static void
+cmds_init() {
+	unsigned int size = 16;
+	while (size < 2 * countof(commands))
+		size *= 2;
+	if (!(cmds.slots = calloc(size, sizeof(Cmd*))))
+		error("calloc: %s\n", strerror(errno));
+	cmds.mask = size - 1;
+	for (unsigned int i = 0; i < countof(commands); i++) {
+		unsigned int h = hash(commands[i].name) & cmds.mask;
+		while (cmds.slots[h])
+			h = (h + 1) & cmds.mask;
+		cmds.slots[h] = &commands[i];
 	}
-	mousemask(mask, NULL);
-#endif /* CONFIG_MOUSE */
 }
 
 static void
@@ -710,12 +1965,45 @@ setup() {
 	initscr();
 	start_color();
 	noecho();
+	/* only for the keypad transmit mode, keys are read by input_read */
 	keypad(stdscr, TRUE);
+	typeahead(-1);
 	mouse_setup();
 	raw();
+	input_init();
 	vt_init();
 	vt_set_keytable(keytable, countof(keytable));
+	/* the extended Sync capability as introduced by tmux */
+	char *sync = tigetstr("Sync");
+	if (sync && sync != (char *)-1) {
+		sync_begin = strdup(tparm(sync, 1));
+		sync_end = strdup(tparm(sync, 2));
+	}
+	if (evtfifo.fd != -1) {
+		fifosub.fd = evtfifo.fd;
+		subscribers = &fifosub;
+	}
 	resize_screen();
+	watcher_init();
+	watch(STDIN_FILENO, NULL);
+	cmds_init();
+	if (cmdfifo.fd != -1)
+		watch(cmdfifo.fd, &cmdfifo);
+	if (control.fd != -1)
+		watch(control.fd, &control);
+	if (bar.fd != -1)
+		watch(bar.fd, &bar);
+#ifdef HAVE_SIGNALFD
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGWINCH);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC)) == -1)
+		error("signalfd: %s\n", strerror(errno));
+	watch(sigfd, NULL);
+#else
 	struct sigaction sa;
 	sa.sa_flags = 0;
 	sigemptyset(&sa.sa_mask);
@@ -725,10 +2013,45 @@ setup() {
 	sigaction(SIGCHLD, &sa, NULL);
 	sa.sa_handler = sigterm_handler;
 	sigaction(SIGTERM, &sa, NULL);
+#endif
+#ifdef CONFIG_READER_THREAD
+	reader_init();
+	workers_init();
+#endif
+}
+
+/* frees a client which is no longer part of any list */
+static void
+release(Client *c) {
+#ifdef CONFIG_READER_THREAD
+	if (c->ring.buf)
+		reader_remove(c);
+#endif
+	if (mgrab == c) {
+		mgrab = NULL;
+		mmotion_pending = false;
+	}
+	/* also drops a pending wait for writability */
+	unwatch(c->pty);
+	if (c->pidfd != -1) {
+		unwatch(c->pidfd);
+		close(c->pidfd);
+	}
+	vt_destroy(c->term);
+	free(c->cmd);
+	free(c);
 }
 
 static void
 destroy(Client *c) {
+	if (c->pooled) {
+		Client **p = &pool.clients;
+		while (*p != c)
+			p = &(*p)->next;
+		*p = c->next;
+		release(c);
+		return;
+	}
 	if (sel == c)
 		focusnextnm(NULL);
 	detach(c);
@@ -739,25 +2062,28 @@ destroy(Client *c) {
 		} else
 			sel = NULL;
 	}
-	werase(c->window);
-	wrefresh(c->window);
-	vt_destroy(c->term);
-	delwin(c->window);
-	if (!clients && countof(actions)) {
-		if (!strcmp(c->cmd, shell))
+	bool isshell = c->cmd && !strcmp(c->cmd, shell);
+	release(c);
+	if (!clients && countof(actions) && running) {
+		if (isshell)
 			quit(NULL);
 		else
 			create(NULL);
 	}
-	free(c);
 	arrange();
 }
 
 static void
 cleanup() {
+	/* nothing is arranged anymore while the clients are destroyed */
+	batch.depth++;
 	while (clients)
 		destroy(clients);
+	while (pool.clients)
+		destroy(pool.clients);
 	vt_shutdown();
+	input.mask = 0;
+	mouse_motion();
 	endwin();
 	free(copybuf);
 	if (bar.fd > 0)
@@ -768,10 +2094,20 @@ cleanup() {
 		close(cmdfifo.fd);
 	if (cmdfifo.file)
 		unlink(cmdfifo.file);
+	events_flush();
+	for (Subscriber *s = subscribers, *next; s; s = next) {
+		next = s->next;
+		if (s != &fifosub)
+			control_close(s);
+	}
 	if (evtfifo.fd > 0)
 		close(evtfifo.fd);
 	if (evtfifo.file)
 		unlink(evtfifo.file);
+	if (control.fd > 0)
+		close(control.fd);
+	if (control.file)
+		unlink(control.file);
 }
 
 static char *getcwd_by_pid(Client *c) {
@@ -782,16 +2118,31 @@ static char *getcwd_by_pid(Client *c) {
 	return realpath(buf, NULL);
 }
 
-/* commands for use by keybindings */
-static void
-create(const char *args[]) {
-	Client *c = calloc(1, sizeof(Client));
-	if (!c)
-		return;
-	const char *cmd = (args && args[0]) ? args[0] : shell;
+/* splits a command which does not need a shell into its words */
+static char**
+split_command(const char *cmd) {
+	if (cmd[strcspn(cmd, "\"'\\$`|&;<>()*?[]{}~#=%!\n")])
+		return NULL;
+	size_t len = strlen(cmd), n = len / 2 + 2, i = 0;
+	char **argv = malloc(n * sizeof(char*) + len + 1);
+	if (!argv)
+		return NULL;
+	char *s = strcpy((char*)(argv + n), cmd);
+	for (char *w = strtok(s, " \t"); w; w = strtok(NULL, " \t"))
+		argv[i++] = w;
+	argv[i] = NULL;
+	if (!i) {
+		free(argv);
+		return NULL;
+	}
+	return argv;
+}
+
+/* starts cmd on a new pty matching the current size of the client */
+static bool
+spawn(Client *c, const char *cmd, const char *cwd) {
 	const char *pargs[] = { "/bin/sh", "-c", cmd, NULL };
-	c->id = ++cmdfifo.id;
-	char buf[8], *cwd = NULL;
+	char buf[8];
 	snprintf(buf, sizeof buf, "%d", c->id);
 	const char *env[] = {
 		"DVTM", VERSION,
@@ -799,39 +2150,160 @@ create(const char *args[]) {
 		NULL
 	};
 
-	if (!(c->window = newwin(wah, waw, way, wax))) {
-		free(c);
-		return;
+	/* the command FIFO reuses the memory of its arguments */
+	c->cmd = strdup(cmd);
+	c->pty = -1;
+	c->pidfd = -1;
+	/* a crowded layout may not leave any room, the terminal
+	 * then starts out minimal and follows once there is some */
+	if (!(c->term = vt_create(max(c->h - 1, 1), max(c->w, 1), screen.history)))
+		return false;
+
+	/* plain commands are executed directly, the shell is only needed
+	 * for anything else or to report why they could not be started */
+	char **argv = split_command(cmd);
+	if (argv)
+		c->pid = vt_forkpty(c->term, argv[0], (const char**)argv, cwd, env, &c->pty);
+	if (!argv || c->pid < 0)
+		c->pid = vt_forkpty(c->term, "/bin/sh", pargs, cwd, env, &c->pty);
+	free(argv);
+#ifdef CONFIG_READER_THREAD
+	if (c->pty != -1 && !reader_add(c))
+		c->died = true;
+#else
+	if (c->pty != -1)
+		watch(c->pty, c);
+#endif
+	/* SIGCHLD is only handled by the main loop, the child can thus not
+	 * yet have been reaped and its pid not been reused */
+	c->pidfd = c->pid > 0 ? open_pidfd(c->pid) : -1;
+	if (c->pidfd != -1)
+		watch(c->pidfd, c);
+	vt_set_data(c->term, c);
+	vt_set_event_handler(c->term, term_event_handler);
+	debug("client with pid %d forked\n", c->pid);
+	return true;
+}
+
+/* starts the shells the pool is missing, called once the screen is
+ * up to date so a pane which was just created is not delayed */
+static void
+pool_fill() {
+	for (; pool.spawn > 0; pool.spawn--) {
+		Client *c = calloc(1, sizeof(Client));
+		if (!c)
+			continue;
+		c->id = ++cmdfifo.id;
+		c->w = screen.w;
+		c->h = screen.h;
+		if (!spawn(c, shell, NULL)) {
+			free(c);
+			continue;
+		}
+		c->pooled = true;
+		c->next = pool.clients;
+		pool.clients = c;
 	}
+}
+
+/* hands out a running shell and schedules its replacement */
+static Client*
+pool_take() {
+	Client **p = &pool.clients;
+	if (!*p)
+		return NULL;
+	/* the oldest one had the most time to initialize */
+	while ((*p)->next)
+		p = &(*p)->next;
+	Client *c = *p;
+	*p = NULL;
+	c->pooled = false;
+	pool.spawn++;
+	return c;
+}
+
+/* an open batch is kept as long as its commands keep arriving */
+static void
+batch_extend() {
+	if (batch.depth)
+		clock_gettime(CLOCK_MONOTONIC, &batch.since);
+}
+
+/* commands for use by keybindings */
+static void
+batchbegin(const char *args[]) {
+	if (requester)
+		requester->batches++;
+	if (!batch.depth++)
+		clock_gettime(CLOCK_MONOTONIC, &batch.since);
+}
 
-	if (!(c->term = vt_create(screen.h - 1, screen.w, screen.history))) {
-		delwin(c->window);
-		free(c);
+static void
+batchcommit(const char *args[]) {
+	/* a connection can only commit the batches it began */
+	if (requester) {
+		if (!requester->batches)
+			return;
+		requester->batches--;
+	}
+	if (!batch.depth || --batch.depth)
 		return;
+	if (batch.arrange) {
+		batch.arrange = false;
+		arrange();
+	}
+}
+
+static void
+create(const char *args[]) {
+	Client *c = NULL, *prev = sel;
+	const char *cmd = (args && args[0]) ? args[0] : shell;
+
+	if (!args || (!args[0] && !args[2]))
+		c = pool_take();
+	if (!c) {
+		if (!(c = calloc(1, sizeof(Client))))
+			return;
+		c->id = ++cmdfifo.id;
+		c->pty = c->pidfd = -1;
 	}
 
-	c->cmd = cmd;
 	if (args && args[1]) {
 		strncpy(c->title, args[1], sizeof(c->title) - 1);
 		c->title[sizeof(c->title) - 1] = '\0';
 	}
-	if (args && args[2])
-		cwd = !strcmp(args[2], "$CWD") ? getcwd_by_pid(sel) : (char*)args[2];
-	c->pid = vt_forkpty(c->term, "/bin/sh", pargs, cwd, env, &c->pty);
-	if (args && args[2] && !strcmp(args[2], "$CWD"))
-		free(cwd);
-	vt_set_data(c->term, c);
-	vt_set_event_handler(c->term, term_event_handler);
 	c->w = screen.w;
 	c->h = screen.h;
 	c->x = wax;
 	c->y = way;
 	c->order = 0;
 	c->minimized = false;
-	debug("client with pid %d forked\n", c->pid);
+	c->unplaced = batch.depth > 0;
 	attach(c);
 	focus(c);
 	arrange();
+	if (c->unplaced)
+		place();
+
+	/* the application starts at the size the layout assigned */
+	if (!c->term) {
+		char *cwd = NULL;
+		if (args && args[2])
+			cwd = !strcmp(args[2], "$CWD") ? getcwd_by_pid(prev) : (char*)args[2];
+		bool spawned = spawn(c, cmd, cwd);
+		if (args && args[2] && !strcmp(args[2], "$CWD"))
+			free(cwd);
+		if (!spawned) {
+			/* unlike destroy() never replaces or quits on the last client */
+			if (prev)
+				focus(prev);
+			else
+				sel = NULL;
+			detach(c);
+			release(c);
+			arrange();
+		}
+	}
 }
 
 static void
@@ -841,16 +2313,16 @@ copymode(const char *args[]) {
 	vt_copymode_enter(sel->term);
 	if (args[0]) {
 		vt_copymode_keypress(sel->term, args[0][0]);
-		draw(sel);
+		sel->dirty = true;
 	}
 }
 
 static void
 escapekey(const char *args[]) {
 	int key;
-	if ((key = getch()) >= 0) {
+	if ((key = readkey()) >= 0) {
 		debug("escaping key `%c'\n", key);
-		keypress(CTRL(key));
+		keypress(CTRL(key), NULL, 0);
 	}
 }
 
@@ -940,14 +2412,15 @@ lock(const char *args[]) {
 	int c;
 
 	erase();
-	curs_set(0);
+	if (curs_set(0) != ERR)
+		cursor_visible = 0;
 
 	if (args && args[0]) {
 		len = strlen(args[0]);
 		pass = (char *)args[0];
 	} else {
 		mvprintw(LINES / 2, COLS / 2 - 7, "Enter password");
-		while (len < sizeof buf && (c = getch()) != '\n')
+		while (len < sizeof buf && (c = readkey()) != '\n')
 			if (c != ERR)
 				buf[len++] = c;
 	}
@@ -956,18 +2429,23 @@ lock(const char *args[]) {
 
 	while (i != len) {
 		for(i = 0; i < len; i++) {
-			if (getch() != pass[i])
+			if (readkey() != pass[i])
 				break;
 		}
 	}
 
+	clear_workspace();
+	drawbar();
 	arrange();
 }
 
 static void
 paste(const char *args[]) {
-	if (sel && copybuf)
-		vt_write(sel->term, copybuf, strlen(copybuf));
+	if (sel && copybuf) {
+		size_t len = strlen(copybuf);
+		if (vt_write(sel->term, copybuf, len) < (int)len)
+			notice("paste truncated, the window does not read its input");
+	}
 }
 
 static void
@@ -978,11 +2456,7 @@ quit(const char *args[]) {
 
 static void
 redraw(const char *args[]) {
-	for (Client *c = clients; c; c = c->next)
-		vt_dirty(c->term);
-	wrefresh(curscr);
 	resize_screen();
-	draw_all(true);
 }
 
 static void
@@ -994,7 +2468,7 @@ scrollback(const char *args[]) {
 	else
 		vt_scroll(sel->term,  sel->h/2);
 
-	draw(sel);
+	sel->dirty = true;
 }
 
 static void
@@ -1050,6 +2524,7 @@ togglebar(const char *args[]) {
 	else
 		bar.pos = BAR_OFF;
 	updatebarpos();
+	clear_workspace();
 	arrange();
 	drawbar();
 }
@@ -1108,7 +2583,7 @@ togglemouse(const char *args[]) {
 static void
 togglerunall(const char *args[]) {
 	runinall = !runinall;
-	draw_all(true);
+	redraw_all = true;
 }
 
 static void
@@ -1156,6 +2631,25 @@ titleid(const char *args[]) {
 	}
 }
 
+static void
+niceid(const char *args[]) {
+	Client *c;
+
+	if (!args[0] || !args[1])
+		return;
+
+	for (c = clients; c; c = c->next) {
+		if (c->id == atoi(args[0])) {
+			c->nice = atoi(args[1]);
+			if (c->nice < 0)
+				c->nice = 0;
+			else if (c->nice > 19)
+				c->nice = 19;
+			break;
+		}
+	}
+}
+
 static void
 setinputmode(const char *args[]) {
 	inputmode = PIPE_NONE;
@@ -1179,6 +2673,22 @@ setinputmode(const char *args[]) {
 	}
 }
 
+static void
+subscribe(const char *args[]) {
+	Subscriber *s = requester ? requester : &fifosub;
+	/* without arguments all types of events are reported */
+	s->mask = args && args[0] ? 0 : ~0u;
+	for (int i = 0; args && i < MAX_ARGS && args[i]; i++) {
+		for (const char *t = args[i]; *t; t++) {
+			if (*t >= 'A' && *t <= 'Z')
+				s->mask |= 1u << (*t - 'A');
+		}
+	}
+	/* a new subscriber starts with the current layout */
+	if (s->mask & 1u << ('A' - 'A'))
+		layout_event(s);
+}
+
 /* commands for use by mouse bindings */
 static void
 mouse_focus(const char *args[]) {
@@ -1210,126 +2720,278 @@ mouse_zoom(const char *args[]) {
 
 static Cmd *
 get_cmd_by_name(const char *name) {
-	for (unsigned int i = 0; i < countof(commands); i++) {
-		if (!strcmp(name, commands[i].name))
-			return &commands[i];
+	for (unsigned int h = hash(name) & cmds.mask; cmds.slots[h]; h = (h + 1) & cmds.mask) {
+		if (!strcmp(name, cmds.slots[h]->name))
+			return cmds.slots[h];
 	}
 	return NULL;
 }
 
+/* splits s in place into at most max words, quotes group words and a
+ * backslash escapes a quote or another backslash */
+static int
+tokenize(char *s, const char *argv[], int max) {
+	char *r = s, *w = s;
+	int argc = 0;
+	for (;;) {
+		while (*r == ' ' || *r == '\t')
+			r++;
+		if (!*r || argc == max)
+			return argc;
+		argv[argc++] = w;
+		for (char quote = '\0'; *r && (quote || (*r != ' ' && *r != '\t')); r++) {
+			if (*r == '\\' && r[1] && strchr("\\'\"", r[1]))
+				*w++ = *++r;
+			else if (!quote && (*r == '\'' || *r == '"'))
+				quote = *r;
+			else if (quote && *r == quote)
+				quote = '\0';
+			else
+				*w++ = *r;
+		}
+		/* the separator is consumed, the terminator thus never
+		 * overwrites what is still to be read */
+		if (*r)
+			r++;
+		*w++ = '\0';
+	}
+}
+
+/* answers a request, independent of what the requester subscribed to */
 static void
-handle_cmdfifo() {
-	int r;
-	char *p, *s, cmdbuf[512], c;
+reply(const char *id, bool ok) {
+	char buf[64];
+	int len;
+	if (!id || !requester)
+		return;
+	if (ok)
+		len = snprintf(buf, sizeof buf, "|%.20s|ok|%d", id, sel ? sel->id : 0);
+	else
+		len = snprintf(buf, sizeof buf, "|%.20s|unknown", id);
+	event_begin('R', requester);
+	event_add(buf, len);
+	event_end();
+}
+
+/* executes a line of the command FIFO or of a control connection: an
+ * optional numeric request ID, the command name and its arguments */
+static void
+handle_command(char *line, Subscriber *from) {
+	const char *argv[MAX_ARGS + 2], *id = NULL;
+	int argc = tokenize(line, argv, countof(argv)), i = 0;
 	Cmd *cmd;
-	switch (r = read(cmdfifo.fd, cmdbuf, sizeof cmdbuf - 1)) {
-	case -1:
-	case 0:
-		cmdfifo.fd = -1;
-		break;
-	default:
-		cmdbuf[r] = '\0';
-		p = cmdbuf;
-		while (*p) {
-			/* find the command name */
-			for (; *p == ' ' || *p == '\n'; p++);
-			for (s = p; *p && *p != ' ' && *p != '\n'; p++);
-			if ((c = *p))
-				*p++ = '\0';
-			if (*s && (cmd = get_cmd_by_name(s)) != NULL) {
-				bool quote = false;
-				int argc = 0;
-				/* XXX: initializer assumes MAX_ARGS == 2 use a initialization loop? */
-				const char *args[MAX_ARGS] = { NULL, NULL, NULL}, *arg;
-				/* if arguments were specified in config.h ignore the one given via
-				 * the named pipe and thus skip everything until we find a new line
-				 */
-				if (cmd->action.args[0] || c == '\n') {
-					debug("execute %s", s);
-					cmd->action.cmd(cmd->action.args);
-					while (*p && *p != '\n')
-						p++;
-					continue;
-				}
-				/* no arguments were given in config.h so we parse the command line */
-				while (*p == ' ')
-					p++;
-				arg = p;
-				for (; (c = *p); p++) {
-					switch (*p) {
-					case '\\':
-						/* remove the escape character '\\' move every
-						 * following character to the left by one position
-						 */
-						switch (p[1]) {
-							case '\\':
-							case '\'':
-							case '\"': {
-								char *t = p+1;
-								do {
-									t[-1] = *t;
-								} while (*t++);
-							}
-						}
-						break;
-					case '\'':
-					case '\"':
-						quote = !quote;
-						break;
-					case ' ':
-						if (!quote) {
-					case '\n':
-							/* remove trailing quote if there is one */
-							if (*(p - 1) == '\'' || *(p - 1) == '\"')
-								*(p - 1) = '\0';
-							*p++ = '\0';
-							/* remove leading quote if there is one */
-							if (*arg == '\'' || *arg == '\"')
-								arg++;
-							if (argc < MAX_ARGS)
-								args[argc++] = arg;
-
-							while (*p == ' ')
-								++p;
-							arg = p--;
-						}
-						break;
-					}
-
-					if (c == '\n' || *p == '\n') {
-						if (!*p)
-							p++;
-						debug("execute %s", s);
-						for(int i = 0; i < argc; i++)
-							debug(" %s", args[i]);
-						debug("\n");
-						cmd->action.cmd(args);
-						break;
-					}
-				}
-			}
+
+	if (argc && isdigit((unsigned char)argv[0][0]) && !argv[0][strspn(argv[0], "0123456789")])
+		id = argv[i++];
+	if (i == argc)
+		return;
+	requester = from;
+	batch_extend();
+	if (!(cmd = get_cmd_by_name(argv[i++]))) {
+		debug("unknown command %s\n", argv[i-1]);
+		reply(id, false);
+		requester = NULL;
+		return;
+	}
+	/* arguments specified in config.h take precedence over the given ones */
+	if (cmd->action.args[0] || i == argc) {
+		debug("execute %s\n", cmd->name);
+		cmd->action.cmd(cmd->action.args);
+	} else {
+		const char *args[MAX_ARGS] = { NULL };
+		debug("execute %s", cmd->name);
+		for (int a = 0; a < MAX_ARGS && i < argc; a++) {
+			args[a] = argv[i++];
+			debug(" %s", args[a]);
 		}
+		debug("\n");
+		cmd->action.cmd(args);
+	}
+	reply(id, true);
+	requester = NULL;
+}
+
+/* commands are only executed once their line is complete, whatever
+ * follows the last newline is kept for the next read */
+static void
+handle_cmdfifo() {
+	CmdFifo *f = &cmdfifo;
+	ssize_t r = read(f->fd, f->buf + f->len, sizeof(f->buf) - f->len);
+	if (r == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (r <= 0) {
+		unwatch(f->fd);
+		f->fd = -1;
+		return;
+	}
+	char *line = f->buf, *end = f->buf + f->len + r, *nl;
+	while ((nl = memchr(line, '\n', end - line))) {
+		*nl = '\0';
+		if (!f->overlong)
+			handle_command(line, &fifosub);
+		f->overlong = false;
+		line = nl + 1;
+	}
+	f->len = end - line;
+	if (f->len == sizeof(f->buf)) {
+		debug("command line too long\n");
+		f->overlong = true;
+		f->len = 0;
+	} else {
+		memmove(f->buf, line, f->len);
+	}
+}
+
+/* only processes of our own user may control us */
+static bool
+peer_allowed(int fd) {
+#ifdef __linux__
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+		return false;
+	return cred.uid == geteuid();
+#else
+	uid_t uid;
+	gid_t gid;
+	if (getpeereid(fd, &uid, &gid) == -1)
+		return false;
+	return uid == geteuid();
+#endif
+}
+
+static void
+control_accept() {
+	Subscriber *s;
+	int fd = accept(control.fd, NULL, NULL);
+	if (fd == -1)
+		return;
+	if (control.count >= CONTROL_MAX || !peer_allowed(fd) ||
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1 ||
+	    !(s = calloc(1, sizeof(*s)))) {
+		close(fd);
+		return;
+	}
+	/* nothing but the replies to its own requests until it subscribes */
+	s->fd = fd;
+	s->packets = true;
+	s->next = subscribers;
+	subscribers = s;
+	control.count++;
+	watch(fd, s);
+}
+
+/* every message holds one or more command lines */
+static void
+handle_control(Subscriber *s) {
+	char buf[CMD_LINE_MAX];
+	struct iovec iov = { buf, sizeof(buf) - 1 };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+	ssize_t r = recvmsg(s->fd, &msg, 0);
+	if (r == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (r <= 0) {
+		control_close(s);
+		return;
+	}
+	if (msg.msg_flags & MSG_TRUNC) {
+		/* the requests it carried can not be answered, the
+		 * client would otherwise wait for their replies forever */
+		control_close(s);
+		return;
+	}
+	buf[r] = '\0';
+	for (char *line = buf, *nl; line; line = nl) {
+		if ((nl = strchr(line, '\n')))
+			*nl++ = '\0';
+		handle_command(line, s);
+	}
+}
+
+static int
+open_control_socket(const char *name, const char **name_created) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat info;
+	int fd;
+
+	if (strlen(name) >= sizeof(addr.sun_path))
+		error("%s: name too long\n", name);
+	strcpy(addr.sun_path, name);
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1)
+		error("socket: %s\n", strerror(errno));
+	/* the socket is only accessible by our own user */
+	mode_t mask = umask(S_IRWXG|S_IRWXO);
+	int res = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+	if (res == -1 && errno == EADDRINUSE) {
+		/* replace a socket nobody listens on anymore, connect
+		 * also fails with ECONNREFUSED for any other file */
+		if (lstat(name, &info) == 0 && !S_ISSOCK(info.st_mode))
+			error("%s is not a socket\n", name);
+		int probe = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+		if (probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof addr) == -1 &&
+		    errno == ECONNREFUSED && !unlink(name))
+			res = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+		else
+			errno = EADDRINUSE;
+		if (probe != -1)
+			close(probe);
 	}
+	umask(mask);
+	if (res == -1)
+		error("%s: %s\n", name, strerror(errno));
+	*name_created = name;
+	if (listen(fd, SOMAXCONN) == -1 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+		error("%s: %s\n", name, strerror(errno));
+	return fd;
+}
+
+/* passes on the latest of the drag motions which were held back */
+static void
+handle_motion() {
+#ifdef CONFIG_MOUSE
+	if (!mmotion_pending)
+		return;
+	mmotion_pending = false;
+	/* without a drag only the focused application gets to see the motion */
+	Client *c = mgrab ? mgrab : sel;
+	if (c)
+		vt_mouse(c->term, mmotion.x - c->x, mmotion.y - c->y - 1, mmotion.bstate);
+#endif /* CONFIG_MOUSE */
 }
 
 static void
 handle_mouse() {
 #ifdef CONFIG_MOUSE
-	MEVENT event;
+	MEVENT event = input.mouse;
+	mmask_t pressed = BUTTON1_PRESSED | BUTTON2_PRESSED | BUTTON3_PRESSED;
+	mmask_t released = BUTTON1_RELEASED | BUTTON2_RELEASED | BUTTON3_RELEASED;
 	unsigned int i;
-	if (getmouse(&event) != OK)
+
+	if (event.bstate & REPORT_MOUSE_POSITION) {
+		/* a drag only needs to reach the application once per frame */
+		mmotion = event;
+		mmotion_pending = mgrab || sel;
 		return;
-	msel = get_client_by_coord(event.x, event.y);
+	}
+	handle_motion();
+
+	/* the pointer only needs to be looked up at the start of a drag */
+	if (!(msel = mgrab))
+		msel = get_client_by_coord(event.x, event.y);
+	if (event.bstate & pressed)
+		mgrab = msel;
+	else if (event.bstate & released)
+		mgrab = NULL;
 
 	if (!msel)
 		return;
 
 	debug("mouse x:%d y:%d cx:%d cy:%d mask:%d\n", event.x, event.y, event.x - msel->x, event.y - msel->y, event.bstate);
 
-	vt_mouse(msel->term, event.x - msel->x, event.y - msel->y, event.bstate);
+	vt_mouse(msel->term, event.x - msel->x, event.y - msel->y - 1, event.bstate);
 
-	for (i = 0; i < countof(buttons); i++) {
-		if (event.bstate & buttons[i].mask)
+	for (i = 0; input.clicks && i < countof(buttons); i++) {
+		if (input.clicks & buttons[i].mask)
 			buttons[i].action.cmd(buttons[i].action.args);
 	}
 
@@ -1337,6 +2999,42 @@ handle_mouse() {
 #endif /* CONFIG_MOUSE */
 }
 
+/* handles the next key of the input buffer, false if there is none */
+static bool
+handle_keyboard(bool flush) {
+	char seq[INPUT_SEQ_MAX];
+	Key *key;
+	int code;
+	size_t len = input_key(&code, seq, flush);
+	if (!len)
+		return false;
+	if (code < 0)
+		return true;
+	if (code == KEY_MOUSE) {
+		handle_mouse();
+	} else if (!(inputmode & PIPE_BINDING) && is_modifier(code)) {
+		int mod = code;
+		code = readkey();
+		if (code >= 0) {
+			if (code == mod)
+				keypress(code, NULL, 0);
+			else if ((key = keybinding(mod, code))) {
+				batch_extend();
+				key->action.cmd(key->action.args);
+			}
+		}
+	} else if (!(inputmode & PIPE_BINDING) && (key = keybinding(0, code))) {
+		batch_extend();
+		key->action.cmd(key->action.args);
+	} else if (sel && vt_copymode(sel->term)) {
+		vt_copymode_keypress(sel->term, code);
+		sel->dirty = true;
+	} else {
+		keypress(code, seq, len);
+	}
+	return true;
+}
+
 static void
 handle_statusbar() {
 	char *p;
@@ -1345,9 +3043,11 @@ handle_statusbar() {
 		case -1:
 			strncpy(bar.text, strerror(errno), sizeof bar.text - 1);
 			bar.text[sizeof bar.text - 1] = '\0';
+			unwatch(bar.fd);
 			bar.fd = -1;
 			break;
 		case 0:
+			unwatch(bar.fd);
 			bar.fd = -1;
 			break;
 		default:
@@ -1386,7 +3086,7 @@ static void
 usage() {
 	cleanup();
 	eprint("usage: dvtm [-v] [-M] [-m mod] [-d delay] [-h lines] [-t title] "
-	       "[-s status-fifo] [-c cmd-fifo] [-e event-fifo] [cmd...]\n");
+	       "[-s status-fifo] [-c cmd-fifo] [-e event-fifo] [-S control-socket] [cmd...]\n");
 	exit(EXIT_FAILURE);
 }
 
@@ -1457,6 +3157,14 @@ parse_args(int argc, char *argv[]) {
 				setenv("DVTM_EVENT_FIFO", fifo, 1);
 				break;
 			}
+			case 'S': {
+				const char *sock;
+				control.fd = open_control_socket(argv[++arg], &control.file);
+				if (!(sock = realpath(argv[arg], NULL)))
+					error("%s\n", strerror(errno));
+				setenv("DVTM_CONTROL_SOCKET", sock, 1);
+				break;
+			}
 			default:
 				usage();
 		}
@@ -1471,27 +3179,64 @@ main(int argc, char *argv[]) {
 		startup(NULL);
 	}
 
+#ifdef CONFIG_READER_THREAD
+	bool pending = false;
+#endif
 	while (running) {
 		Client *c, *t;
-		int r, nfds = 0;
-		fd_set rd;
+		Subscriber *s;
+		int n, timeout = -1, delay = -1;
+		bool keyboard = false;
+#ifdef CONFIG_READER_THREAD
+		bool rings = false;
+#endif
 
 		if (screen.need_resize) {
-			resize_screen();
-			screen.need_resize = false;
+			/* the size has to settle while the host terminal is being resized */
+			int ms = RESIZE_DELAY - elapsed(&screen.resized);
+			if (ms <= 0) {
+				resize_screen();
+				screen.need_resize = false;
+			} else {
+				delay = ms;
+			}
+		}
+
+		if (bar.notice[0]) {
+			int ms = NOTICE_TIMEOUT - elapsed(&bar.noticed);
+			if (ms <= 0) {
+				bar.notice[0] = '\0';
+				drawbar();
+			} else if (delay == -1 || ms < delay) {
+				delay = ms;
+			}
 		}
 
-		FD_ZERO(&rd);
-		FD_SET(STDIN_FILENO, &rd);
+		if (batch.depth) {
+			/* a script which never commits must not freeze the screen */
+			int ms = BATCH_TIMEOUT - elapsed(&batch.since);
+			if (ms <= 0) {
+				for (s = subscribers; s; s = s->next)
+					s->batches = 0;
+				batch.depth = 1;
+				batchcommit(NULL);
+			} else if (delay == -1 || ms < delay) {
+				delay = ms;
+			}
+		}
 
-		if (cmdfifo.fd != -1) {
-			FD_SET(cmdfifo.fd, &rd);
-			nfds = cmdfifo.fd;
+		if (children_died) {
+			children_died = false;
+			reap();
 		}
 
-		if (bar.fd != -1) {
-			FD_SET(bar.fd, &rd);
-			nfds = max(nfds, bar.fd);
+		/* pooled shells may already query the terminal while starting up */
+		for (c = pool.clients; c; c = t) {
+			t = c->next;
+			if (c->died)
+				destroy(c);
+			else
+				flush_client(c);
 		}
 
 		for (c = clients; c; ) {
@@ -1501,77 +3246,165 @@ main(int argc, char *argv[]) {
 				c = t;
 				continue;
 			}
-			FD_SET(c->pty, &rd);
-			nfds = max(nfds, c->pty);
+			/* pass on the input queued since the last round */
+			flush_client(c);
+			vt_resize(c->term, c->h - 1, c->w);
+			if (c->held && !vt_copymode(c->term)) {
+				c->held = false;
+				watch(c->pty, c);
+			}
+			/* wake up when a pending synchronized update expires */
+			int ms = vt_sync_timeout(c->term);
+			if (ms >= 0 && (timeout == -1 || ms < timeout))
+				timeout = ms;
 			c = c->next;
 		}
-		r = select(nfds + 1, &rd, NULL, NULL, NULL);
 
-		if (r == -1 && errno == EINTR)
+		render();
+		pool_fill();
+		events_flush();
+
+#ifdef CONFIG_READER_THREAD
+		/* some rings still hold data exceeding the budget of the last round */
+		if (pending)
+			timeout = 0;
+#endif
+		/* an incomplete sequence is passed on once the escape delay expired */
+		int ms = input_timeout();
+		if (ms >= 0 && (delay == -1 || ms < delay))
+			delay = ms;
+		n = watcher_wait(delay >= 0 && (timeout == -1 || delay < timeout) ? delay : timeout);
+
+		if (n == -1 && errno == EINTR)
 			continue;
 
-		if (r < 0) {
-			perror("select()");
+		if (n < 0) {
+			perror("watcher_wait()");
 			exit(EXIT_FAILURE);
 		}
 
-		if (FD_ISSET(STDIN_FILENO, &rd)) {
-			int code = getch();
-			Key *key;
-			if (code >= 0) {
-				if (code == KEY_MOUSE) {
-					handle_mouse();
-				} else if (!(inputmode & PIPE_BINDING) && is_modifier(code)) {
-					int mod = code;
-					code = getch();
-					if (code >= 0) {
-						if (code == mod)
-							keypress(code);
-						else if ((key = keybinding(mod, code)))
-							key->action.cmd(key->action.args);
-					}
-				} else if (!(inputmode & PIPE_BINDING) && (key = keybinding(0, code))) {
-					key->action.cmd(key->action.args);
-				} else if (sel && vt_copymode(sel->term)) {
-					vt_copymode_keypress(sel->term, code);
-					draw(sel);
-				} else {
-					keypress(code);
-				}
-			}
-			if (r == 1) /* no data available on pty's */
-				continue;
+		if (timeout != -1) {
+			/* present the clients whose synchronized update timed out */
+			for (c = clients; c; c = c->next)
+				c->dirty = true;
+		}
+
+		for (int i = 0; i < watcher.nready; i++) {
+			if (watcher.ready[i] == STDIN_FILENO)
+				keyboard = true;
 		}
 
-		if (cmdfifo.fd != -1 && FD_ISSET(cmdfifo.fd, &rd))
-			handle_cmdfifo();
+		if (keyboard || input_timeout() == 0) {
+			/* everything which is available is handled before the next
+			 * render, the keys are written with one system call per client
+			 * at the start of the next round */
+			bool readable = keyboard;
+			do {
+				if (readable && !input_read()) {
+					/* the host terminal is gone */
+					unwatch(STDIN_FILENO);
+					break;
+				}
+				while (handle_keyboard(input_timeout() == 0));
+			} while ((readable = input_pending()));
+			handle_motion();
+		}
 
-		if (bar.fd != -1 && FD_ISSET(bar.fd, &rd))
-			handle_statusbar();
+		/* the applications are ready to accept more of their queued input */
+		for (int i = 0; i < watcher.nwritable; i++) {
+			int fd = watcher.writable[i];
+			if (fd == -1)
+				continue;
+			if ((s = get_subscriber(fd)))
+				subscriber_flush(s);
+			else if ((c = watcher.data[fd]))
+				flush_client(c);
+		}
 
-		for (c = clients; c; ) {
-			if (FD_ISSET(c->pty, &rd) && !vt_copymode(c->term)) {
-				if (vt_process(c->term) < 0 && errno == EIO) {
+		/* only the clients with pending output are looked at, commands
+		 * never destroy clients thus the reported ones are still valid */
+		for (int i = 0; i < watcher.nready; i++) {
+			int fd = watcher.ready[i];
+			if (fd == -1 || fd == STDIN_FILENO)
+				continue;
+			if (fd == cmdfifo.fd) {
+				handle_cmdfifo();
+				continue;
+			}
+			if (fd == control.fd) {
+				control_accept();
+				continue;
+			}
+			if ((s = get_subscriber(fd))) {
+				handle_control(s);
+				continue;
+			}
+			if (fd == bar.fd) {
+				handle_statusbar();
+				continue;
+			}
+#ifdef HAVE_SIGNALFD
+			if (fd == sigfd) {
+				handle_signals();
+				continue;
+			}
+#endif
+#ifdef CONFIG_READER_THREAD
+			if (fd == reader.evfd) {
+				uint64_t count;
+				read(reader.evfd, &count, sizeof count);
+				rings = true;
+				continue;
+			}
+#endif
+			if (!(c = watcher.data[fd]))
+				continue;
+			if (fd == c->pidfd) {
+				waitpid(c->pid, NULL, WNOHANG);
+				destroy(c);
+				continue;
+			}
+			/* every client gets a share of the round according to its nice
+			 * level, whatever is left is reported again by the next wait */
+			if (vt_process(c->term, PROCESS_BUDGET * (20 - c->nice) / 20) < 0) {
+				if (errno == EIO) {
 					/* client probably terminated */
-					t = c->next;
 					destroy(c);
-					c = t;
 					continue;
 				}
-				if (c != sel) {
-					draw_content(c);
-					if (!isarrange(fullscreen))
-						wnoutrefresh(c->window);
+				if (errno == ENOBUFS) {
+					/* copy mode already holds back as much as it may */
+					watcher_update(fd, watcher.mask[fd] & ~POLLIN);
+					c->held = true;
 				}
 			}
-			c = c->next;
+			c->dirty = true;
 		}
 
-		if (sel) {
-			draw_content(sel);
-			wnoutrefresh(sel->window);
+#ifdef CONFIG_READER_THREAD
+		/* the keyboard input might have ended the copy mode of a client */
+		if (rings || pending || keyboard) {
+			pending = false;
+			workers.count = 0;
+			for (c = clients; c; c = c->next)
+				workers_add(c);
+			for (c = pool.clients; c; c = c->next)
+				workers_add(c);
+			workers_run();
+			for (int i = 0; i < workers.count; i++) {
+				c = workers.jobs[i];
+				flush_client(c);
+				switch (workers.results[i]) {
+				case -1:
+					destroy(c);
+					break;
+				case 1:
+					pending = true;
+					break;
+				}
+			}
 		}
-		doupdate();
+#endif
 	}
 
 	cleanup();
@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <langinfo.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,9 +30,12 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <termios.h>
+#include <time.h>
+#include <unistd.h>
 #include <wchar.h>
 #if defined(__linux__) || defined(__CYGWIN__)
 # include <pty.h>
+# include <sys/syscall.h>
 #elif defined(__FreeBSD__)
 # include <libutil.h>
 #elif defined(__OpenBSD__) || defined(__NetBSD__) || defined(__APPLE__)
@@ -40,6 +44,13 @@
 #if defined(__CYGWIN__) || defined(_AIX)
 # include <alloca.h>
 #endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+# include <spawn.h>
+# define HAVE_CLOSEFROM 1
+# define HAVE_POSIX_SPAWN_PTY 1
+#elif defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+# define HAVE_CLOSEFROM 1
+#endif
 
 #include "vt.h"
 
@@ -65,20 +76,66 @@
 # endif
 # if !NCURSES_EXT_COLORS
 #  define MAX_COLOR_PAIRS 256
+# elif NCURSES_VERSION_MAJOR >= 6
+#  define HAVE_EXTENDED_PAIRS 1
 # endif
 #endif
+#ifndef HAVE_EXTENDED_PAIRS
+# define HAVE_EXTENDED_PAIRS 0
+#endif
 #ifndef MAX_COLOR_PAIRS
-# define MAX_COLOR_PAIRS COLOR_PAIRS
+# if HAVE_EXTENDED_PAIRS
+#  define MAX_COLOR_PAIRS 0x10000
+# else
+#  define MAX_COLOR_PAIRS 0x7fff
+# endif
 #endif
 
+/* 24-bit colors are stored as 0x01rrggbb to keep them apart from
+ * the palette indices used by the indexed SGR sequences */
+#define COLOR_RGB_FLAG (1 << 24)
+#define COLOR_RGB(r, g, b) (COLOR_RGB_FLAG | ((r) << 16) | ((g) << 8) | (b))
+#define IS_COLOR_RGB(c) ((c) >= 0 && ((c) & COLOR_RGB_FLAG))
+#define DIRECT_COLORS (1 << 24)
+
 #define IS_CONTROL(ch) !((ch) & 0xffffff60UL)
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 #define sstrlen(str) (sizeof(str) - 1)
+#define countof(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #define COPYMODE_ATTR A_REVERSE
-static bool is_utf8, has_default_colors;
-static short color_pairs_reserved, color_pairs_max, color_pair_current;
-static short *color2palette, default_fg, default_bg;
+/* maximal time in milliseconds a synchronized update may defer drawing */
+#define SYNC_UPDATE_TIMEOUT 150
+/* maximal number of parameters of a CSI sequence */
+#define CSI_PARAM_MAX 256
+/* maximal amount of input held back for an application not reading it */
+#define OUTPUT_QUEUE_MAX (1024 * 1024)
+/* maximal amount of output kept aside while in copy mode */
+#define HOLD_MAX (1024 * 1024)
+static bool is_utf8, has_default_colors, has_direct_colors;
+static int color_pairs_reserved, color_pairs_max, color_pair_current;
+static short default_fg, default_bg;
+
+/* maps a (fg, bg) pair of curses colors to the color pair number,
+ * reserved pairs are stored with a negative sign. The table uses
+ * open addressing and grows on demand, keys are never 0. */
+typedef struct {
+	uint64_t key;
+	int pair;
+} ColorPair;
+
+static struct {
+	ColorPair *entries;
+	unsigned int size, count;
+	uint64_t *keys;      /* color pair number -> key, used for eviction */
+	int keys_size;
+} color_pairs;
+
+/* quantized colors for hosts without direct color support */
+static struct {
+	int rgb;
+	short color;
+} color_rgb_cache[256];
 static char vt_term[32] = "dvtm";
 
 typedef struct {
@@ -103,8 +160,8 @@ typedef struct {
 typedef struct {
 	wchar_t text;
 	uint16_t attr;
-	short fg;
-	short bg;
+	int fg;
+	int bg;
 } Cell;
 
 typedef struct {
@@ -126,7 +183,7 @@ typedef struct {
 	int rows, cols, maxcols;
 	unsigned curattrs, savattrs;
 	int curs_col, curs_srow, curs_scol;
-	short curfg, curbg, savfg, savbg;
+	int curfg, curbg, savfg, savbg;
 } Buffer;
 
 struct Vt {
@@ -134,12 +191,11 @@ struct Vt {
 	Buffer buffer_alternate;
 	Buffer *buffer;
 	unsigned defattrs;
-	short deffg, defbg;
+	int deffg, defbg;
 	int pty;
 	pid_t childpid;
 
 	/* flags */
-	unsigned seen_input:1;
 	unsigned insert:1;
 	unsigned escaped:1;
 	unsigned curshid:1;
@@ -147,11 +203,18 @@ struct Vt {
 	unsigned copymode:1;
 	unsigned copymode_selecting:1;
 	unsigned bell:1;
+	unsigned ringing:1; /* a bell was received but not yet passed on */
+	unsigned titled:1;  /* a title was received but not yet passed on */
 	unsigned relposmode:1;
-	unsigned mousetrack:1;
+	unsigned mousesgr:1;
 	unsigned graphmode:1;
 	unsigned savgraphmode:1;
+	unsigned syncupdate:1;
 	bool charsets[2];
+	/* mouse tracking mode requested by the application: 0, 1000, 1002 or 1003 */
+	int mousetrack;
+	/* start of the synchronized update (DEC mode 2026) in progress */
+	struct timespec sync_start;
 	/* copymode */
 	int copymode_curs_srow, copymode_curs_scol;
 	Row *copymode_sel_start_row;
@@ -162,6 +225,15 @@ struct Vt {
 	char rbuf[BUFSIZ];
 	char ebuf[BUFSIZ];
 	unsigned int rlen, elen;
+	/* output which arrived during copy mode, parsed once it ends */
+	char *hbuf;
+	size_t hlen, hsize;
+	/* input not yet accepted by the pty, bytes from ostart up to olen */
+	char *obuf;
+	size_t ostart, olen, osize;
+	int csiparam[CSI_PARAM_MAX];
+	/* whether the parameter was separated by a colon (sub parameter) */
+	bool csisub[CSI_PARAM_MAX];
 
 	/* xterm style window title */
 	char title[256];
@@ -226,8 +298,10 @@ static const char *keytable[KEY_MAX+1] = {
 static void puttab(Vt *t, int count);
 static void process_nonprinting(Vt *t, wchar_t wc);
 static void send_curs(Vt *t);
+static void send_mode(Vt *t, int mode);
 static void cmdline_hide_callback(void *t);
 static void cmdline_free(Cmdline *c);
+static void color_pair_set(WINDOW *win, int pair);
 
 static int xwcwidth(wchar_t c) {
 	int w = wcwidth(c);
@@ -406,8 +480,49 @@ static bool is_valid_csi_ender(int c)
 	    || (c == '@' || c == '`');
 }
 
+static int clamp_color_component(int c)
+{
+	return c < 0 ? 0 : c > 255 ? 255 : c;
+}
+
+/* interprets the color arguments following SGR 38 and 48, both the
+ * indexed (5;n) and the 24-bit (2;r;g;b) forms are understood, the
+ * latter also in its colon separated 2:[colorspace]:r:g:b variant.
+ * Returns the number of consumed parameters. */
+static int interpret_csi_sgr_color(int param[], bool sub[], int pcount, int *color)
+{
+	int n = 0, first = 1;
+
+	if (pcount < 2)
+		return pcount;
+
+	switch (param[0]) {
+	case 5:
+		*color = param[1];
+		return 2;
+	case 2:
+		if (sub[0]) {
+			while (n + 1 < pcount && sub[n + 1])
+				n++;
+			/* skip the optional color space identifier */
+			if (n >= 4)
+				first = 2;
+		} else {
+			n = pcount - 1;
+		}
+		if (n < 3)
+			return n + 1;
+		*color = COLOR_RGB(clamp_color_component(param[first]),
+		                   clamp_color_component(param[first + 1]),
+		                   clamp_color_component(param[first + 2]));
+		return sub[0] ? n + 1 : 4;
+	default:
+		return 1;
+	}
+}
+
 /* interprets a 'set attribute' (SGR) CSI escape sequence */
-static void interpret_csi_sgr(Vt *t, int param[], int pcount)
+static void interpret_csi_sgr(Vt *t, int param[], bool sub[], int pcount)
 {
 	Buffer *b = t->buffer;
 	if (pcount == 0) {
@@ -427,7 +542,11 @@ static void interpret_csi_sgr(Vt *t, int param[], int pcount)
 			b->curattrs |= A_BOLD;
 			break;
 		case 4:
-			b->curattrs |= A_UNDERLINE;
+			/* 4:0 turns underlining off, any other style turns it on */
+			if (i + 1 < pcount && sub[i + 1] && param[i + 1] == 0)
+				b->curattrs &= ~A_UNDERLINE;
+			else
+				b->curattrs |= A_UNDERLINE;
 			break;
 		case 5:
 			b->curattrs |= A_BLINK;
@@ -457,10 +576,7 @@ static void interpret_csi_sgr(Vt *t, int param[], int pcount)
 			b->curfg = param[i] - 30;
 			break;
 		case 38:
-			if ((i + 2) < pcount && param[i + 1] == 5) {
-				b->curfg = param[i + 2];
-				i += 2;
-			}
+			i += interpret_csi_sgr_color(param + i + 1, sub + i + 1, pcount - i - 1, &b->curfg);
 			break;
 		case 39:
 			b->curfg = -1;
@@ -469,10 +585,7 @@ static void interpret_csi_sgr(Vt *t, int param[], int pcount)
 			b->curbg = param[i] - 40;
 			break;
 		case 48:
-			if ((i + 2) < pcount && param[i + 1] == 5) {
-				b->curbg = param[i + 2];
-				i += 2;
-			}
+			i += interpret_csi_sgr_color(param + i + 1, sub + i + 1, pcount - i - 1, &b->curbg);
 			break;
 		case 49:
 			b->curbg = -1;
@@ -486,6 +599,9 @@ static void interpret_csi_sgr(Vt *t, int param[], int pcount)
 		default:
 			break;
 		}
+		/* colon separated sub-parameters only matter for the colors */
+		while (i + 1 < pcount && sub[i + 1])
+			i++;
 	}
 }
 
@@ -713,7 +829,8 @@ static void interpret_csi_decstbm(Vt *t, int param[], int pcount)
 
 static void interpret_csi(Vt *t)
 {
-	static int csiparam[BUFSIZ];
+	int *csiparam = t->csiparam;
+	bool *csisub = t->csisub;
 	Buffer *b = t->buffer;
 	int param_count = 0;
 	const char *p = t->ebuf + 1;
@@ -723,21 +840,27 @@ static void interpret_csi(Vt *t)
 	for (p += (t->ebuf[1] == '?'); *p; p++) {
 		if (IS_CONTROL(*p)) {
 			process_nonprinting(t, *p);
-		} else if (*p == ';') {
-			if (param_count >= (int)sizeof(csiparam))
+		} else if (*p == ';' || *p == ':') {
+			if (*p == ':' && (verb != 'm' || t->ebuf[1] == '?'))
+				return;	/* sub-parameters are only known to SGR */
+			if (param_count >= CSI_PARAM_MAX)
 				return;	/* too long! */
+			csisub[param_count] = (*p == ':');
 			csiparam[param_count++] = 0;
 		} else if (isdigit((unsigned char)*p)) {
-			if (param_count == 0)
+			if (param_count == 0) {
+				csisub[param_count] = false;
 				csiparam[param_count++] = 0;
+			}
 			csiparam[param_count - 1] *= 10;
 			csiparam[param_count - 1] += *p - '0';
 		}
 	}
 
 	if (t->ebuf[1] == '?') {
-		if (verb == 'h') { /* DEC Private Mode Set (DECSET) */
-			switch (csiparam[0]) {
+		/* several modes might be changed at once */
+		for (int i = 0; i < param_count && verb == 'h'; i++) { /* DEC Private Mode Set (DECSET) */
+			switch (csiparam[i]) {
 			case 1: /* set ANSI cursor (application) key mode (DECCKM) */
 				t->curskeymode = true;
 				break;
@@ -753,11 +876,21 @@ static void interpret_csi(Vt *t)
 				vt_dirty(t);
 				break;
 			case 1000: /* enable normal mouse tracking */
-				t->mousetrack = true;
+			case 1002: /* also report motion while a button is held */
+			case 1003: /* report all motion */
+				t->mousetrack = csiparam[i];
+				break;
+			case 1006: /* SGR mouse encoding */
+				t->mousesgr = true;
+				break;
+			case 2026: /* begin synchronized update */
+				t->syncupdate = true;
+				clock_gettime(CLOCK_MONOTONIC, &t->sync_start);
 				break;
 			}
-		} else if (verb == 'l') { /* DEC Private Mode Reset (DECRST) */
-			switch (csiparam[0]) {
+		}
+		for (int i = 0; i < param_count && verb == 'l'; i++) { /* DEC Private Mode Reset (DECRST) */
+			switch (csiparam[i]) {
 			case 1: /* reset ANSI cursor (normal) key mode (DECCKM) */
 				t->curskeymode = false;
 				break;
@@ -772,11 +905,23 @@ static void interpret_csi(Vt *t)
 				t->buffer = &t->buffer_normal;
 				vt_dirty(t);
 				break;
-			case 1000: /* disable normal mouse tracking */
-				t->mousetrack = false;
+			case 1000: /* disable mouse tracking */
+			case 1002:
+			case 1003:
+				t->mousetrack = 0;
+				break;
+			case 1006: /* X10 mouse encoding */
+				t->mousesgr = false;
+				break;
+			case 2026: /* end synchronized update */
+				t->syncupdate = false;
 				break;
 			}
 		}
+		if (verb == 'p' && t->ebuf[t->elen - 2] == '$') {
+			/* DEC Private Mode Request (DECRQM) */
+			send_mode(t, csiparam[0]);
+		}
 	}
 
 	/* delegate handling depending on command character (verb) */
@@ -790,7 +935,7 @@ static void interpret_csi(Vt *t)
 			t->insert = false;
 		break;
 	case 'm': /* it's a 'set attribute' sequence */
-		interpret_csi_sgr(t, csiparam, param_count);
+		interpret_csi_sgr(t, csiparam, csisub, param_count);
 		break;
 	case 'J': /* it's an 'erase display' sequence */
 		interpret_csi_ed(t, csiparam, param_count);
@@ -909,17 +1054,15 @@ static void interpret_csi_scs(Vt *t)
 static void interpret_esc_xterm(Vt *t)
 {
 	/* ESC]n;dataBEL -- the ESC is not part of t->ebuf */
-	char *title = NULL;
-
 	switch (t->ebuf[1]) {
 	case '0':
 	case '2':
 		t->ebuf[t->elen - 1] = '\0';
+		t->title[0] = '\0';
 		if (t->elen > sstrlen("]n;\a"))
-			title = t->ebuf + sstrlen("]n;");
-
-		if (t->event_handler)
-			t->event_handler(t, VT_EVENT_TITLE, title);
+			strncat(t->title, t->ebuf + sstrlen("]n;"), sizeof(t->title) - 1);
+		/* the handler is not thread safe, vt_flush calls it */
+		t->titled = true;
 	}
 }
 
@@ -1045,7 +1188,7 @@ static void process_nonprinting(Vt *t, wchar_t wc)
 		break;
 	case '\a': /* BEL */
 		if (t->bell)
-			beep();
+			t->ringing = true;
 		break;
 	case '\b': /* BS */
 		if (b->curs_col > 0)
@@ -1109,11 +1252,6 @@ static void put_wc(Vt *t, wchar_t wc)
 {
 	int width = 0;
 
-	if (!t->seen_input) {
-		t->seen_input = 1;
-		kill(-t->childpid, SIGWINCH);
-	}
-
 	if (t->escaped) {
 		if (t->elen + 1 < sizeof(t->ebuf)) {
 			t->ebuf[t->elen] = wc;
@@ -1162,33 +1300,19 @@ static void put_wc(Vt *t, wchar_t wc)
 	}
 }
 
-int vt_process(Vt *t)
+static void process_input(Vt *t)
 {
-	int res;
 	unsigned int pos = 0;
 	mbstate_t ps;
 	memset(&ps, 0, sizeof(ps));
 
-	if (t->pty < 0) {
-		errno = EINVAL;
-		return -1;
-	}
-
-	res = read(t->pty, t->rbuf + t->rlen, sizeof(t->rbuf) - t->rlen);
-	if (res < 0)
-		return -1;
-
-	t->rlen += res;
 	while (pos < t->rlen) {
 		wchar_t wc;
 		ssize_t len;
 
 		len = (ssize_t)mbrtowc(&wc, t->rbuf + pos, t->rlen - pos, &ps);
-		if (len == -2) {
-			t->rlen -= pos;
-			memmove(t->rbuf, t->rbuf + pos, t->rlen);
-			return 0;
-		}
+		if (len == -2)
+			break;
 
 		if (len == -1) {
 			len = 1;
@@ -1201,9 +1325,84 @@ int vt_process(Vt *t)
 
 	t->rlen -= pos;
 	memmove(t->rbuf, t->rbuf + pos, t->rlen);
+}
+
+/* makes room for up to len more bytes of held back output, returns how
+ * many of them fit */
+static size_t hold_reserve(Vt *t, size_t len)
+{
+	if (len > HOLD_MAX - t->hlen)
+		len = HOLD_MAX - t->hlen;
+	if (t->hlen + len > t->hsize) {
+		size_t size = t->hsize ? t->hsize : BUFSIZ;
+		while (size < t->hlen + len)
+			size *= 2;
+		size = MIN(size, HOLD_MAX);
+		char *hbuf = realloc(t->hbuf, size);
+		if (!hbuf)
+			return 0;
+		t->hbuf = hbuf;
+		t->hsize = size;
+	}
+	return len;
+}
+
+/* the application keeps running during copy mode, its output does not
+ * disturb the view and is parsed by vt_copymode_leave. Fails with ENOBUFS
+ * once HOLD_MAX bytes are held back. */
+int vt_process(Vt *t, size_t max)
+{
+	int res;
+
+	if (t->pty < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (t->copymode) {
+		if (!(max = hold_reserve(t, max))) {
+			errno = ENOBUFS;
+			return -1;
+		}
+		res = read(t->pty, t->hbuf + t->hlen, max);
+		if (res < 0)
+			return -1;
+		t->hlen += res;
+		return 0;
+	}
+
+	/* anything beyond max stays in the kernel buffer for the next call */
+	if (max > sizeof(t->rbuf) - t->rlen)
+		max = sizeof(t->rbuf) - t->rlen;
+	res = read(t->pty, t->rbuf + t->rlen, max);
+	if (res < 0)
+		return -1;
+
+	t->rlen += res;
+	process_input(t);
+	vt_flush(t);
 	return 0;
 }
 
+/* unlike vt_process this neither touches curses nor raises events,
+ * different terminals can thus be fed concurrently. The caller has to
+ * call vt_flush afterwards */
+size_t vt_feed(Vt *t, const char *buf, size_t len)
+{
+	if (t->copymode) {
+		len = hold_reserve(t, len);
+		memcpy(t->hbuf + t->hlen, buf, len);
+		t->hlen += len;
+		return len;
+	}
+	if (len > sizeof(t->rbuf) - t->rlen)
+		len = sizeof(t->rbuf) - t->rlen;
+	memcpy(t->rbuf + t->rlen, buf, len);
+	t->rlen += len;
+	process_input(t);
+	return len;
+}
+
 void vt_set_default_colors(Vt *t, unsigned attrs, short fg, short bg)
 {
 	t->defattrs = attrs;
@@ -1368,6 +1567,9 @@ void vt_resize(Vt *t, int rows, int cols)
 
 	if (rows <= 0 || cols <= 0)
 		return;
+	/* neither bother the application nor reflow the history needlessly */
+	if (rows == t->buffer->rows && cols == t->buffer->cols)
+		return;
 
 	vt_noscroll(t);
 	if (t->copymode)
@@ -1386,6 +1588,8 @@ void vt_destroy(Vt *t)
 	buffer_free(&t->buffer_normal);
 	buffer_free(&t->buffer_alternate);
 	cmdline_free(t->cmdline);
+	free(t->hbuf);
+	free(t->obuf);
 	free(t);
 }
 
@@ -1447,6 +1651,21 @@ static void copymode_get_selection_boundry(Vt *t, Row **start_row, int *start_co
 	}
 }
 
+int vt_sync_timeout(Vt *t)
+{
+	struct timespec now;
+	if (!t->syncupdate)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long elapsed = (now.tv_sec - t->sync_start.tv_sec) * 1000 +
+	               (now.tv_nsec - t->sync_start.tv_nsec) / 1000000;
+	if (elapsed >= SYNC_UPDATE_TIMEOUT) {
+		t->syncupdate = false;
+		return 0;
+	}
+	return SYNC_UPDATE_TIMEOUT - elapsed;
+}
+
 void vt_draw(Vt *t, WINDOW * win, int srow, int scol)
 {
 	Buffer *b = t->buffer;
@@ -1454,8 +1673,14 @@ void vt_draw(Vt *t, WINDOW * win, int srow, int scol)
 	Row *sel_row_start, *sel_row_end;
 	int sel_col_start, sel_col_end;
 
+	/* keep the previous frame until the synchronized update is complete,
+	 * the cursor is still placed since win may be shared with other terminals */
+	if (vt_sync_timeout(t) > 0) {
+		wmove(win, srow + b->curs_row - b->lines, scol + b->curs_col);
+		return;
+	}
+
 	copymode_get_selection_boundry(t, &sel_row_start, &sel_col_start, &sel_row_end, &sel_col_end, true);
-	curs_set(0);
 
 	for (int i = 0; i < b->rows; i++) {
 		Row *row = b->lines + i;
@@ -1478,7 +1703,7 @@ void vt_draw(Vt *t, WINDOW * win, int srow, int scol)
 				if (cell->bg == -1)
 					cell->bg = t->defbg;
 				wattrset(win, (attr_t) cell->attr << NCURSES_ATTR_SHIFT);
-				wcolor_set(win, vt_color_get(t, cell->fg, cell->bg), NULL);
+				color_pair_set(win, vt_color_get(t, cell->fg, cell->bg));
 			}
 
 			if (t->copymode_selecting && ((row > sel_row_start && row < sel_row_end) ||
@@ -1488,7 +1713,7 @@ void vt_draw(Vt *t, WINDOW * win, int srow, int scol)
 				sel = true;
 			} else if (sel) {
 				wattrset(win, (attr_t) cell->attr << NCURSES_ATTR_SHIFT);
-				wcolor_set(win, vt_color_get(t, cell->fg, cell->bg), NULL);
+				color_pair_set(win, vt_color_get(t, cell->fg, cell->bg));
 				sel = false;
 			}
 
@@ -1507,8 +1732,8 @@ void vt_draw(Vt *t, WINDOW * win, int srow, int scol)
 
 		int x, y;
 		getyx(win, y, x);
-		(void)y;
-		if (x && x < b->cols - 1)
+		x -= scol;
+		if (y == srow + i && x > 0 && x < b->cols - 1)
 			whline(win, ' ', b->cols - x);
 
 		row->dirty = false;
@@ -1518,16 +1743,14 @@ void vt_draw(Vt *t, WINDOW * win, int srow, int scol)
 
 	if (t->cmdline && t->cmdline->state) {
 		wattrset(win, t->defattrs << NCURSES_ATTR_SHIFT);
-		mvwaddch(win, srow + b->rows - 1, 0, t->cmdline->prefix);
+		mvwaddch(win, srow + b->rows - 1, scol, t->cmdline->prefix);
 		whline(win, ' ', b->cols - 1);
 		if (t->cmdline->state == CMDLINE_ACTIVE) {
 			waddnwstr(win, t->cmdline->display, b->cols - 1);
-			wmove(win, srow + b->rows - 1, 1 + t->cmdline->cursor_pos);
+			wmove(win, srow + b->rows - 1, scol + 1 + t->cmdline->cursor_pos);
 		} else
-			wmove(win, srow + b->rows - 1, 1);
+			wmove(win, srow + b->rows - 1, scol + 1);
 	}
-
-	curs_set(vt_cursor(t));
 }
 
 void vt_scroll(Vt *t, int rows)
@@ -1565,38 +1788,179 @@ void vt_togglebell(Vt *t)
 	t->bell = !t->bell;
 }
 
+/* closes all file descriptors from fd upwards */
+static void close_from(int fd)
+{
+#ifdef HAVE_CLOSEFROM
+	closefrom(fd);
+#else
+# ifdef SYS_close_range
+	if (syscall(SYS_close_range, fd, ~0U, 0) == 0)
+		return;
+# endif
+	for (int maxfd = sysconf(_SC_OPEN_MAX); fd < maxfd; fd++)
+		close(fd);
+#endif
+}
+
+#ifdef HAVE_POSIX_SPAWN_PTY
+extern char **environ;
+
+/* the environment of the child: ours with the name, value pairs of env
+ * and the terminal description overridden, the first *owned entries
+ * are allocated */
+static char **spawn_env(const char *env[], size_t *owned)
+{
+	const char *vars[64];
+	size_t nvars = 0, nenv = 0;
+	for (const char **e = env; e && e[0] && nvars < countof(vars) - 4; e += 2) {
+		vars[nvars++] = e[0];
+		vars[nvars++] = e[1];
+	}
+	vars[nvars++] = "TERM";
+	vars[nvars++] = vt_term;
+	if (has_direct_colors) {
+		vars[nvars++] = "COLORTERM";
+		vars[nvars++] = "truecolor";
+	}
+	while (environ[nenv])
+		nenv++;
+	char **envp = malloc((nenv + nvars / 2 + 1) * sizeof(char*));
+	if (!envp)
+		return NULL;
+	size_t n = 0;
+	for (size_t i = 0; i < nvars; i += 2) {
+		size_t len = strlen(vars[i]) + strlen(vars[i+1]) + 2;
+		if (!(envp[n] = malloc(len)))
+			break;
+		snprintf(envp[n++], len, "%s=%s", vars[i], vars[i+1]);
+	}
+	*owned = n;
+	for (char **e = environ; *e; e++) {
+		size_t i;
+		for (i = 0; i < nvars; i += 2) {
+			size_t len = strlen(vars[i]);
+			if (!strncmp(*e, vars[i], len) && (*e)[len] == '=')
+				break;
+		}
+		if (i >= nvars)
+			envp[n++] = *e;
+	}
+	envp[n] = NULL;
+	return envp;
+}
+
+/* starts the child without duplicating our address space, the slave is
+ * opened after setsid(2) and thus becomes its controlling terminal */
+static pid_t spawn_pty(Vt *t, const char *p, const char *argv[], const char *cwd, const char *env[], struct winsize *ws)
+{
+	int master, slave, err;
+	char name[64];
+	pid_t pid = -1;
+	size_t owned = 0;
+	char **envp;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+	sigset_t emptyset;
+
+	if (openpty(&master, &slave, NULL, NULL, ws) == -1)
+		return -1;
+	if (ptsname_r(master, name, sizeof name) || !(envp = spawn_env(env, &owned))) {
+		close(master);
+		close(slave);
+		return -1;
+	}
+
+	sigemptyset(&emptyset);
+	posix_spawnattr_init(&attr);
+	/* do not pass on the signals blocked by the caller */
+	posix_spawnattr_setsigmask(&attr, &emptyset);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK);
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 0, name, O_RDWR, 0);
+	posix_spawn_file_actions_adddup2(&actions, 0, 1);
+	posix_spawn_file_actions_adddup2(&actions, 0, 2);
+	posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+	/* a failing chdir(2) would fail the whole spawn */
+	if (cwd && access(cwd, X_OK) == 0)
+		posix_spawn_file_actions_addchdir_np(&actions, cwd);
+
+	err = posix_spawnp(&pid, p, &actions, &attr, (char *const *)argv, envp);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	for (size_t i = 0; i < owned; i++)
+		free(envp[i]);
+	free(envp);
+	close(slave);
+
+	if (err) {
+		close(master);
+		errno = err;
+		return -1;
+	}
+	t->pty = master;
+	return pid;
+}
+#endif
+
 pid_t vt_forkpty(Vt *t, const char *p, const char *argv[], const char *cwd, const char *env[], int *pty)
 {
 	struct winsize ws;
 	pid_t pid;
 	const char **envp = env;
-	int fd, maxfd;
 
 	ws.ws_row = t->buffer->rows;
 	ws.ws_col = t->buffer->cols;
 	ws.ws_xpixel = ws.ws_ypixel = 0;
 
+#ifdef HAVE_POSIX_SPAWN_PTY
+	pid = spawn_pty(t, p, argv, cwd, env, &ws);
+#else
 	pid = forkpty(&t->pty, NULL, NULL, &ws);
+#endif
 	if (pid < 0)
 		return -1;
 
+	/* a child which does not read its input must never block us */
+	if (pid > 0)
+		fcntl(t->pty, F_SETFL, fcntl(t->pty, F_GETFL) | O_NONBLOCK);
+
 	if (pid == 0) {
+		/* do not pass on the signals blocked by the caller */
+		sigset_t emptyset;
+		sigemptyset(&emptyset);
+		sigprocmask(SIG_SETMASK, &emptyset, NULL);
 		setsid();
 
-		maxfd = sysconf(_SC_OPEN_MAX);
-		for (fd = 3; fd < maxfd; fd++)
-			if (close(fd) == -1 && errno == EBADF)
-				break;
+		close_from(3);
 
 		while (envp && envp[0]) {
 			setenv(envp[0], envp[1], 1);
 			envp += 2;
 		}
 		setenv("TERM", vt_term, 1);
+		if (has_direct_colors)
+			setenv("COLORTERM", "truecolor", 1);
 		if (cwd)
 			chdir(cwd);
-		execv(p, (char *const *)argv);
-		fprintf(stderr, "\nexecv() failed.\nCommand: '%s'\n", argv[0]);
+		execvp(p, (char *const *)argv);
+		if (strcmp(p, "/bin/sh")) {
+			/* a command started without the shell is handed to it,
+			 * which reports why it could not be executed */
+			size_t len = 1;
+			for (const char **a = argv; *a; a++)
+				len += strlen(*a) + 1;
+			char cmd[len];
+			cmd[0] = '\0';
+			for (const char **a = argv; *a; a++) {
+				if (a != argv)
+					strcat(cmd, " ");
+				strcat(cmd, *a);
+			}
+			execl("/bin/sh", "/bin/sh", "-c", cmd, (char *)NULL);
+		}
+		fprintf(stderr, "\nexecvp() failed.\nCommand: '%s'\n", argv[0]);
 		exit(1);
 	}
 
@@ -1610,23 +1974,124 @@ int vt_getpty(Vt *t)
 	return t->pty;
 }
 
-int vt_write(Vt *t, const char *buf, int len)
+/* writes as much of the queued input as the pty accepts without blocking */
+static void flush_input(Vt *t)
 {
-	int ret = len;
-
-	while (len > 0) {
-		int res = write(t->pty, buf, len);
+	while (t->ostart < t->olen) {
+		ssize_t res = write(t->pty, t->obuf + t->ostart, t->olen - t->ostart);
 		if (res < 0) {
-			if (errno != EAGAIN && errno != EINTR)
-				return -1;
-			else
+			if (errno == EINTR)
 				continue;
+			if (errno != EAGAIN)
+				t->ostart = t->olen; /* nobody is going to read it */
+			break;
+		}
+		t->ostart += res;
+	}
+	if (t->ostart == t->olen)
+		t->ostart = t->olen = 0;
+}
+
+/* all input destined for the pty is collected and written by vt_flush, up
+ * to OUTPUT_QUEUE_MAX bytes are held back while the application does not
+ * read. Returns the number of bytes accepted, -1 with errno set to EAGAIN
+ * if the queue is full. */
+static int queue_input(Vt *t, const char *buf, size_t len)
+{
+	if (t->ostart > 0) {
+		t->olen -= t->ostart;
+		memmove(t->obuf, t->obuf + t->ostart, t->olen);
+		t->ostart = 0;
+	}
+	if (len > OUTPUT_QUEUE_MAX - t->olen)
+		len = OUTPUT_QUEUE_MAX - t->olen;
+	if (len == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (t->olen + len > t->osize) {
+		size_t size = t->osize ? t->osize : BUFSIZ;
+		while (size < t->olen + len)
+			size *= 2;
+		size = MIN(size, OUTPUT_QUEUE_MAX);
+		char *obuf = realloc(t->obuf, size);
+		if (!obuf) {
+			errno = ENOMEM;
+			return -1;
 		}
-		buf += res;
-		len -= res;
+		t->obuf = obuf;
+		t->osize = size;
 	}
+	memcpy(t->obuf + t->olen, buf, len);
+	t->olen += len;
+	return len;
+}
+
+int vt_write(Vt *t, const char *buf, int len)
+{
+	int res = queue_input(t, buf, len);
+	flush_input(t);
+	return res;
+}
 
-	return ret;
+/* whether some input is waiting for the pty to become writable */
+bool vt_write_pending(Vt *t)
+{
+	return t->olen > 0;
+}
+
+/* passes on the input, bells and title changes which were held back */
+void vt_flush(Vt *t)
+{
+	flush_input(t);
+	if (t->ringing) {
+		t->ringing = false;
+		beep();
+	}
+	if (t->titled) {
+		t->titled = false;
+		if (t->event_handler)
+			t->event_handler(t, VT_EVENT_TITLE, t->title[0] ? t->title : NULL);
+	}
+}
+
+static void send_mode(Vt *t, int mode)
+{
+	char keyseq[32];
+	int state;
+
+	switch (mode) {
+	case 1:
+		state = t->curskeymode;
+		break;
+	case 6:
+		state = t->relposmode;
+		break;
+	case 25:
+		state = !t->curshid;
+		break;
+	case 47:
+		state = t->buffer == &t->buffer_alternate;
+		break;
+	case 1000:
+	case 1002:
+	case 1003:
+		state = t->mousetrack == mode;
+		break;
+	case 1006:
+		state = t->mousesgr;
+		break;
+	case 2026:
+		state = t->syncupdate;
+		break;
+	default:
+		state = -1;
+		break;
+	}
+
+	/* 0: not recognized, 1: set, 2: reset */
+	snprintf(keyseq, sizeof keyseq, "\e[?%d;%d$y", mode, state < 0 ? 0 : state ? 1 : 2);
+	queue_input(t, keyseq, strlen(keyseq));
 }
 
 static void send_curs(Vt *t)
@@ -1634,7 +2099,7 @@ static void send_curs(Vt *t)
 	Buffer *b = t->buffer;
 	char keyseq[16];
 	snprintf(keyseq, sizeof keyseq, "\e[%d;%dR", (int)(b->curs_row - b->lines), b->curs_col);
-	vt_write(t, keyseq, strlen(keyseq));
+	queue_input(t, keyseq, strlen(keyseq));
 }
 
 void vt_keypress(Vt *t, int keycode)
@@ -1650,14 +2115,14 @@ void vt_keypress(Vt *t, int keycode)
 		case KEY_RIGHT:
 		case KEY_LEFT: {
 			char keyseq[3] = { '\e', (t->curskeymode ? 'O' : '['), keytable[keycode][0] };
-			vt_write(t, keyseq, sizeof keyseq);
+			queue_input(t, keyseq, sizeof keyseq);
 			break;
 		}
 		default:
-			vt_write(t, keytable[keycode], strlen(keytable[keycode]));
+			queue_input(t, keytable[keycode], strlen(keytable[keycode]));
 		}
 	} else {
-		vt_write(t, &c, 1);
+		queue_input(t, &c, 1);
 	}
 }
 
@@ -2225,23 +2690,56 @@ void vt_copymode_keypress(Vt *t, int keycode)
 	t->copymode_cmd_multiplier = 0;
 }
 
+#ifdef NCURSES_MOUSE_VERSION
+static void send_mouse(Vt *t, int button, int x, int y, bool release)
+{
+	char seq[32];
+	int len;
+
+	if (t->mousesgr) {
+		/* SGR encoding (DEC mode 1006), no limit on the coordinates */
+		len = snprintf(seq, sizeof seq, "\e[<%d;%d;%d%c", button, x + 1, y + 1, release ? 'm' : 'M');
+	} else {
+		/* X10 encoding, coordinates beyond 223 can not be represented */
+		if (x + 1 > 223 || y + 1 > 223)
+			return;
+		len = snprintf(seq, sizeof seq, "\e[M%c%c%c", 32 + (release ? 3 | (button & ~3) : button), 32 + x + 1, 32 + y + 1);
+	}
+	/* a report the application has no room for is outdated by then */
+	vt_write(t, seq, len);
+}
+#endif /* NCURSES_MOUSE_VERSION */
+
+/* reports a mouse event at the zero based position within the terminal
+ * to the application, mask describes it using the curses conventions */
 void vt_mouse(Vt *t, int x, int y, mmask_t mask)
 {
 #ifdef NCURSES_MOUSE_VERSION
-	char seq[6] = { '\e', '[', 'M' }, state = 0, button = 0;
+	int button = 0, state = 0;
 
-	if (!t->mousetrack)
+	if (!t->mousetrack || x < 0 || y < 0 || x >= t->buffer->cols || y >= t->buffer->rows)
 		return;
 
-	if (mask & (BUTTON1_PRESSED | BUTTON1_CLICKED))
+	if (mask & (BUTTON1_PRESSED | BUTTON1_CLICKED | BUTTON1_RELEASED))
 		button = 0;
-	else if (mask & (BUTTON2_PRESSED | BUTTON2_CLICKED))
+	else if (mask & (BUTTON2_PRESSED | BUTTON2_CLICKED | BUTTON2_RELEASED))
 		button = 1;
-	else if (mask & (BUTTON3_PRESSED | BUTTON3_CLICKED))
+	else if (mask & (BUTTON3_PRESSED | BUTTON3_CLICKED | BUTTON3_RELEASED))
 		button = 2;
-	else if (mask & (BUTTON1_RELEASED | BUTTON2_RELEASED | BUTTON3_RELEASED))
+	else if (mask & BUTTON4_PRESSED)
+		button = 64;
+#ifdef BUTTON5_PRESSED
+	else if (mask & BUTTON5_PRESSED)
+		button = 65;
+#endif
+	else
 		button = 3;
 
+	if (mask & REPORT_MOUSE_POSITION) {
+		if (t->mousetrack == 1000 || (button == 3 && t->mousetrack != 1003))
+			return;
+		state |= 32;
+	}
 	if (mask & BUTTON_SHIFT)
 		state |= 4;
 	if (mask & BUTTON_ALT)
@@ -2249,36 +2747,230 @@ void vt_mouse(Vt *t, int x, int y, mmask_t mask)
 	if (mask & BUTTON_CTRL)
 		state |= 16;
 
-	seq[3] = 32 + button + state;
-	seq[4] = 32 + x;
-	seq[5] = 32 + y;
+	bool release = mask & (BUTTON1_RELEASED | BUTTON2_RELEASED | BUTTON3_RELEASED);
+	send_mouse(t, button | state, x, y, release);
+	if (mask & (BUTTON1_CLICKED | BUTTON2_CLICKED | BUTTON3_CLICKED))
+		send_mouse(t, button | state, x, y, true);
+#endif /* NCURSES_MOUSE_VERSION */
+}
 
-	vt_write(t, seq, sizeof seq);
+/* the mouse tracking mode the application enabled: 0, 1000, 1002 or 1003 */
+int vt_mousetrack(Vt *t)
+{
+	return t->mousetrack;
+}
 
-	if (mask & (BUTTON1_CLICKED | BUTTON2_CLICKED | BUTTON3_CLICKED)) {
-		/* send a button release event */
-		button = 3;
-		seq[3] = 32 + button + state;
-		vt_write(t, seq, sizeof seq);
+static int color_pair_init(int pair, int fg, int bg)
+{
+#if HAVE_EXTENDED_PAIRS
+	return init_extended_pair(pair, fg, bg);
+#else
+	return init_pair(pair, fg, bg);
+#endif
+}
+
+static void color_pair_set(WINDOW *win, int pair)
+{
+#if HAVE_EXTENDED_PAIRS
+	wcolor_set(win, 0, &pair);
+#else
+	wcolor_set(win, pair, NULL);
+#endif
+}
+
+static uint64_t color_key(int fg, int bg)
+{
+	return ((uint64_t)(uint32_t)(fg + 2) << 32) | (uint32_t)(bg + 2);
+}
+
+static unsigned int color_key_hash(uint64_t key)
+{
+	key *= 0x9E3779B97F4A7C15ULL;
+	return key >> 32;
+}
+
+static ColorPair *color_pairs_lookup(uint64_t key)
+{
+	if (!color_pairs.size)
+		return NULL;
+	unsigned int mask = color_pairs.size - 1;
+	for (unsigned int i = color_key_hash(key) & mask;; i = (i + 1) & mask) {
+		ColorPair *e = &color_pairs.entries[i];
+		if (e->key == key)
+			return e;
+		if (!e->key)
+			return NULL;
 	}
-#endif /* NCURSES_MOUSE_VERSION */
 }
 
-static unsigned int color_hash(short fg, short bg)
+static ColorPair *color_pairs_insert(uint64_t key, int pair)
+{
+	if (2 * (color_pairs.count + 1) > color_pairs.size) {
+		unsigned int size = color_pairs.size ? 2 * color_pairs.size : 256;
+		ColorPair *old = color_pairs.entries, *entries = calloc(size, sizeof(ColorPair));
+		if (!entries)
+			return NULL;
+		unsigned int old_size = color_pairs.size;
+		color_pairs.entries = entries;
+		color_pairs.size = size;
+		color_pairs.count = 0;
+		for (unsigned int i = 0; i < old_size; i++) {
+			if (old[i].key)
+				color_pairs_insert(old[i].key, old[i].pair);
+		}
+		free(old);
+	}
+
+	unsigned int mask = color_pairs.size - 1, i = color_key_hash(key) & mask;
+	while (color_pairs.entries[i].key && color_pairs.entries[i].key != key)
+		i = (i + 1) & mask;
+	ColorPair *e = &color_pairs.entries[i];
+	if (!e->key)
+		color_pairs.count++;
+	e->key = key;
+	e->pair = pair;
+	return e;
+}
+
+static void color_pairs_remove(uint64_t key)
+{
+	ColorPair *e = color_pairs_lookup(key);
+	if (!e)
+		return;
+	/* backward shift deletion, keeps probe sequences intact */
+	unsigned int mask = color_pairs.size - 1;
+	unsigned int i = e - color_pairs.entries, j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		ColorPair *n = &color_pairs.entries[j];
+		if (!n->key)
+			break;
+		unsigned int home = color_key_hash(n->key) & mask;
+		if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+			color_pairs.entries[i] = *n;
+			i = j;
+		}
+	}
+	color_pairs.entries[i].key = 0;
+	color_pairs.count--;
+}
+
+/* remembers which key a color pair number is currently used for */
+static bool color_pairs_assign(int pair, uint64_t key)
+{
+	if (pair >= color_pairs.keys_size) {
+		int size = color_pairs.keys_size ? 2 * color_pairs.keys_size : 256;
+		while (size <= pair)
+			size *= 2;
+		if (size > color_pairs_max)
+			size = color_pairs_max;
+		uint64_t *keys = realloc(color_pairs.keys, size * sizeof(uint64_t));
+		if (!keys)
+			return false;
+		memset(keys + color_pairs.keys_size, 0, (size - color_pairs.keys_size) * sizeof(uint64_t));
+		color_pairs.keys = keys;
+		color_pairs.keys_size = size;
+	}
+
+	/* drop the mapping of the previous user of this pair number */
+	uint64_t old = color_pairs.keys[pair];
+	if (old) {
+		ColorPair *e = color_pairs_lookup(old);
+		if (e && (e->pair == pair || e->pair == -pair))
+			color_pairs_remove(old);
+	}
+	color_pairs.keys[pair] = key;
+	return true;
+}
+
+/* the standard xterm 256 color palette */
+static int color_index_to_rgb(int color)
 {
-	if (fg == -1)
-		fg = COLORS;
-	if (bg == -1)
-		bg = COLORS + 1;
-	return fg * (COLORS + 2) + bg;
+	static const int ansi[16] = {
+		0x000000, 0xcd0000, 0x00cd00, 0xcdcd00, 0x0000ee, 0xcd00cd, 0x00cdcd, 0xe5e5e5,
+		0x7f7f7f, 0xff0000, 0x00ff00, 0xffff00, 0x5c5cff, 0xff00ff, 0x00ffff, 0xffffff,
+	};
+	static const int levels[6] = { 0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff };
+
+	if (color < 16)
+		return ansi[color];
+	if (color < 232) {
+		color -= 16;
+		return (levels[color / 36] << 16) | (levels[(color / 6) % 6] << 8) | levels[color % 6];
+	}
+	int gray = 8 + 10 * (color - 232);
+	return (gray << 16) | (gray << 8) | gray;
+}
+
+static int color_distance(int rgb1, int rgb2)
+{
+	int r = ((rgb1 >> 16) & 0xff) - ((rgb2 >> 16) & 0xff);
+	int g = ((rgb1 >> 8) & 0xff) - ((rgb2 >> 8) & 0xff);
+	int b = (rgb1 & 0xff) - (rgb2 & 0xff);
+	return 2 * r * r + 4 * g * g + 3 * b * b;
+}
+
+/* maps a 24-bit color to the closest entry of the palette available on the host */
+static short color_rgb_quantize(int rgb)
+{
+	unsigned int slot = ((rgb >> 16) * 31 + (rgb >> 8) * 7 + rgb) & (countof(color_rgb_cache) - 1);
+	if (color_rgb_cache[slot].rgb == rgb)
+		return color_rgb_cache[slot].color;
+
+	int best = 0, best_distance = -1;
+	if (COLORS >= 256) {
+		/* only consider the closest cube and gray entries */
+		int r = (rgb >> 16) & 0xff, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+		#define CUBE_LEVEL(c) ((c) < 48 ? 0 : (c) < 115 ? 1 : ((c) - 35) / 40)
+		int candidates[] = {
+			16 + 36 * CUBE_LEVEL(r) + 6 * CUBE_LEVEL(g) + CUBE_LEVEL(b),
+			232 + MIN(23, ((r + g + b) / 3 > 8 ? ((r + g + b) / 3 - 3) / 10 : 0)),
+		};
+		#undef CUBE_LEVEL
+		for (unsigned int i = 0; i < countof(candidates); i++) {
+			int d = color_distance(rgb, color_index_to_rgb(candidates[i]));
+			if (best_distance == -1 || d < best_distance) {
+				best = candidates[i];
+				best_distance = d;
+			}
+		}
+	} else {
+		int colors = COLORS >= 16 ? 16 : 8;
+		for (int i = 0; i < colors; i++) {
+			int d = color_distance(rgb, color_index_to_rgb(i));
+			if (best_distance == -1 || d < best_distance) {
+				best = i;
+				best_distance = d;
+			}
+		}
+	}
+
+	color_rgb_cache[slot].rgb = rgb;
+	color_rgb_cache[slot].color = best;
+	return best;
 }
 
-short vt_color_get(Vt *t, short fg, short bg)
+/* translates a cell color into a color number understood by curses */
+static int color_translate(int color, int fallback)
 {
-	if (fg >= COLORS)
-		fg = (t ? t->deffg : default_fg);
-	if (bg >= COLORS)
-		bg = (t ? t->defbg : default_bg);
+	if (IS_COLOR_RGB(color)) {
+		int rgb = color & ~COLOR_RGB_FLAG;
+		if (!has_direct_colors)
+			return color_rgb_quantize(rgb);
+		/* values below 8 denote the ANSI colors in direct color mode */
+		return rgb < 8 ? 8 : rgb;
+	}
+	if (color >= COLORS || color < -1)
+		return fallback;
+	if (has_direct_colors && color >= 8)
+		return color_index_to_rgb(color);
+	return color;
+}
+
+int vt_color_get(Vt *t, int fg, int bg)
+{
+	fg = color_translate(fg, t ? t->deffg : default_fg);
+	bg = color_translate(bg, t ? t->defbg : default_bg);
 
 	if (!has_default_colors) {
 		if (fg == -1)
@@ -2287,33 +2979,27 @@ short vt_color_get(Vt *t, short fg, short bg)
 			bg = (t && t->defbg != -1 ? t->defbg : default_bg);
 	}
 
-	if (!color2palette || (fg == -1 && bg == -1))
+	if (!COLORS || (fg == -1 && bg == -1))
 		return 0;
-	unsigned int index = color_hash(fg, bg);
-	if (color2palette[index] == 0) {
-		short oldfg, oldbg;
-		for (;;) {
-			if (++color_pair_current >= color_pairs_max)
-				color_pair_current = color_pairs_reserved + 1;
-			pair_content(color_pair_current, &oldfg, &oldbg);
-			unsigned int old_index = color_hash(oldfg, oldbg);
-			if (color2palette[old_index] >= 0) {
-				if (init_pair(color_pair_current, fg, bg) == OK) {
-					color2palette[old_index] = 0;
-					color2palette[index] = color_pair_current;
-				}
-				break;
-			}
-		}
+	if (color_pairs_max <= color_pairs_reserved + 1)
+		return 0;
+	uint64_t key = color_key(fg, bg);
+	ColorPair *e = color_pairs_lookup(key);
+	if (!e) {
+		if (++color_pair_current >= color_pairs_max || color_pair_current <= color_pairs_reserved)
+			color_pair_current = color_pairs_reserved + 1;
+		if (color_pair_init(color_pair_current, fg, bg) != OK ||
+		    !color_pairs_assign(color_pair_current, key) ||
+		    !(e = color_pairs_insert(key, color_pair_current)))
+			return 0;
 	}
 
-	short color_pair = color2palette[index];
-	return color_pair >= 0 ? color_pair : -color_pair;
+	return e->pair >= 0 ? e->pair : -e->pair;
 }
 
 short vt_color_reserve(short fg, short bg)
 {
-	if (!color2palette || fg >= COLORS || bg >= COLORS)
+	if (!COLORS || fg >= COLORS || bg >= COLORS)
 		return 0;
 	if (!has_default_colors && fg == -1)
 		fg = default_fg;
@@ -2321,13 +3007,20 @@ short vt_color_reserve(short fg, short bg)
 		bg = default_bg;
 	if (fg == -1 && bg == -1)
 		return 0;
-	unsigned int index = color_hash(fg, bg);
-	if (color2palette[index] >= 0) {
-		if (init_pair(++color_pairs_reserved, fg, bg) == OK)
-			color2palette[index] = -color_pairs_reserved;
+	int cfg = color_translate(fg, fg), cbg = color_translate(bg, bg);
+	uint64_t key = color_key(cfg, cbg);
+	ColorPair *e = color_pairs_lookup(key);
+	if (!e || e->pair >= 0) {
+		int pair = color_pairs_reserved + 1;
+		if (pair >= color_pairs_max || pair > SHRT_MAX)
+			return e ? e->pair : 0;
+		if (color_pair_init(pair, cfg, cbg) != OK || !color_pairs_assign(pair, key))
+			return 0;
+		color_pairs_reserved = pair;
+		if (!(e = color_pairs_insert(key, -pair)))
+			return 0;
 	}
-	short color_pair = color2palette[index];
-	return color_pair >= 0 ? color_pair : -color_pair;
+	return -e->pair;
 }
 
 static void init_colors(void)
@@ -2338,9 +3031,10 @@ static void init_colors(void)
 	if (default_bg == -1)
 		default_bg = COLOR_BLACK;
 	has_default_colors = (use_default_colors() == OK);
+	has_direct_colors = HAVE_EXTENDED_PAIRS && COLORS >= DIRECT_COLORS;
 	color_pairs_max = MIN(COLOR_PAIRS, MAX_COLOR_PAIRS);
-	if (COLORS)
-		color2palette = calloc((COLORS + 2) * (COLORS + 2), sizeof(short));
+	for (unsigned int i = 0; i < countof(color_rgb_cache); i++)
+		color_rgb_cache[i].rgb = -1;
 	vt_color_reserve(COLOR_WHITE, COLOR_BLACK);
 }
 
@@ -2367,7 +3061,8 @@ void vt_set_keytable(const char * const keytable_overlay[], int count)
 
 void vt_shutdown(void)
 {
-	free(color2palette);
+	free(color_pairs.entries);
+	free(color_pairs.keys);
 }
 
 void vt_set_escseq_handler(Vt *t, vt_escseq_handler_t handler)
@@ -2424,6 +3119,16 @@ void vt_copymode_leave(Vt *t)
 	t->copymode_cmd_multiplier = 0;
 	b->curs_row = b->lines + t->copymode_curs_srow;
 	b->curs_col = t->copymode_curs_scol;
+	/* catch up with the output of the meantime */
+	for (size_t pos = 0, len; pos < t->hlen; pos += len) {
+		len = MIN(t->hlen - pos, sizeof(t->rbuf) - t->rlen);
+		memcpy(t->rbuf + t->rlen, t->hbuf + pos, len);
+		t->rlen += len;
+		process_input(t);
+	}
+	free(t->hbuf);
+	t->hbuf = NULL;
+	t->hlen = t->hsize = 0;
 	cmdline_hide(t->cmdline);
 	vt_noscroll(t);
 	vt_dirty(t);
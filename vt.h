@@ -76,13 +76,18 @@ pid_t vt_forkpty(Vt *, const char *, const char *argv[], const char *cwd, const
 int vt_getpty(Vt *);
 unsigned vt_cursor(Vt *t);
 
-int vt_process(Vt *);
+int vt_process(Vt *, size_t max);
+size_t vt_feed(Vt *, const char *buf, size_t len);
+void vt_flush(Vt *);
 void vt_keypress(Vt *, int keycode);
 int vt_write(Vt *t, const char *buf, int len);
+bool vt_write_pending(Vt *t);
 void vt_mouse(Vt *t, int x, int y, mmask_t mask);
+int vt_mousetrack(Vt *t);
 void vt_dirty(Vt *t);
 void vt_draw(Vt *, WINDOW *win, int startrow, int startcol);
-short vt_color_get(Vt *t, short fg, short bg);
+int vt_sync_timeout(Vt *);
+int vt_color_get(Vt *t, int fg, int bg);
 short vt_color_reserve(short fg, short bg);
 
 void vt_scroll(Vt *, int rows);